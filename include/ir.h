@@ -15,6 +15,13 @@ void node_init (
     node_t *nd, node_index_t type, void *data, uint64_t n_children, ...
 );
 
+// Export the subtree destructor, it is needed by the optimizer
+void destroy_subtree ( node_t *discard );
+
+// Kinds of statements and expressions, needed by the optimizer and generator
+bool is_call ( node_t *node );
+bool is_assignment ( node_t *node );
+
 typedef enum {
     SYM_GLOBAL_VAR, SYM_FUNCTION, SYM_PARAMETER, SYM_LOCAL_VAR
 } symtype_t;
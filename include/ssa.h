@@ -0,0 +1,108 @@
+#ifndef SSA_H
+#define SSA_H
+
+/* Static single assignment form of a function. Local variables and
+ * parameters become virtual registers, each assigned by exactly one
+ * instruction, with phi instructions where control flow joins. Globals
+ * may be changed by calls, so they are loaded and stored explicitly. */
+
+typedef enum {
+    SSA_CONSTANT,       // The constant
+    SSA_PARAMETER,      // The parameter with the given index
+    SSA_LOAD_GLOBAL,    // The value of a global
+    SSA_STORE_GLOBAL,   // Stores operand 0 in a global
+    SSA_UNARY,          // op operand 0
+    SSA_BINARY,         // operand 0 op operand 1
+    SSA_CALL,           // Calls a function with the operands as arguments
+    SSA_PHI,            // The operand for the predecessor control came from
+    SSA_PRINT_TEXT,     // Prints a piece of constant text
+    SSA_PRINT_VALUE,    // Prints operand 0
+    // Terminators, exactly one of them ends each block
+    SSA_JUMP,           // Continues in successor 0
+    SSA_BRANCH,         // Successor 0 if operand 0 op operand 1, else 1
+    SSA_RETURN          // Returns operand 0
+} ssa_opcode_t;
+
+typedef struct ssa_instruction ssa_instruction_t;
+typedef struct ssa_block ssa_block_t;
+
+struct ssa_instruction {
+    ssa_opcode_t opcode;
+    // Number of the virtual register holding the result
+    size_t id;
+    // Operator of unary and binary instructions and branches. Besides the
+    // operators of the language, binary instructions may shift operand 0
+    // right by the constant operand 1, written '>'
+    char op;
+    // Set on divisions whose operands are known to be non-negative and to
+    // fit in 32 bits
+    bool narrow;
+    int64_t constant;
+    size_t parameter;
+    // The global, the called function, or the variable a phi joins
+    symbol_t *symbol;
+    char *text;
+    ssa_instruction_t **operands;
+    size_t n_operands;
+    ssa_block_t *block;
+    // Set when all uses of the instruction should use another one instead
+    ssa_instruction_t *replacement;
+};
+
+struct ssa_block {
+    size_t id;
+    // The phi instructions come first, and a terminator last
+    ssa_instruction_t **instructions;
+    size_t n_instructions;
+    size_t capacity;
+    ssa_block_t **predecessors;
+    size_t n_predecessors;
+    size_t predecessor_capacity;
+    ssa_block_t *successors[2];
+    size_t n_successors;
+    // The target of a backward jump
+    bool is_loop_header;
+    // Used while building, see ssa.c
+    bool sealed;
+    tlhash_t definitions;
+};
+
+typedef struct {
+    symbol_t *function;
+    // In reverse postorder, starting with the entry block
+    ssa_block_t **blocks;
+    size_t n_blocks;
+    size_t capacity;
+    // The number of virtual registers
+    size_t n_values;
+} ssa_function_t;
+
+ssa_function_t *build_ssa_function ( symbol_t *function );
+void print_ssa_function ( ssa_function_t *ssa );
+void destroy_ssa_function ( ssa_function_t *ssa );
+/* Gives each edge from a block with several successors to a block with
+ * several predecessors a block of its own, which is added at the end */
+void split_critical_edges ( ssa_function_t *ssa );
+
+ssa_instruction_t *ssa_create_instruction ( ssa_opcode_t opcode, size_t n_operands );
+/* Puts an instruction into a block at the given index, moving the ones
+ * from there on down */
+void ssa_insert_instruction ( ssa_block_t *block, ssa_instruction_t *instruction, size_t position );
+
+/* Checks if an instruction produces a value */
+bool ssa_has_value ( ssa_instruction_t *instruction );
+/* Follows the replacements of an instruction */
+ssa_instruction_t *ssa_resolve ( ssa_instruction_t *instruction );
+/* Removes unreachable blocks and phis that don't join different values,
+ * puts the blocks in reverse postorder and numbers the values */
+void ssa_clean_up ( ssa_function_t *ssa );
+/* Removes the edge from a block to one of its successors, along with the
+ * phi operands for it. The remaining successor becomes successor 0 */
+void ssa_remove_edge ( ssa_block_t *block, size_t successor );
+/* Makes all uses of replaced instructions use their replacements instead,
+ * removes the replaced ones and numbers the blocks and values again */
+void ssa_apply_replacements ( ssa_function_t *ssa );
+
+/* Improves the SSA form of a function, in ssa_optimizer.c */
+void optimize_ssa_function ( ssa_function_t *ssa );
+#endif
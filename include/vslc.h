@@ -16,9 +16,23 @@
 // Definition of the tree node type
 #include "ir.h"
 
+// Static single assignment form of functions, needs def. of symbol type
+#include "ssa.h"
+
 // Token definitions and other things from bison, needs def. of node type
 #include "y.tab.h"
 
+// Macros that avoid evaluating twice
+#define MIN(a, b) \
+    ({ __typeof__ (a) _a = (a); \
+       __typeof__ (b) _b = (b); \
+     _a < _b ? _a : _b; })
+
+#define MAX(a, b) \
+    ({ __typeof__ (a) _a = (a); \
+       __typeof__ (b) _b = (b); \
+     _a > _b ? _a : _b; })
+
 /* This is generated from the bison grammar, calls on the flex specification */
 int yyerror ( const char *error );
 
@@ -39,12 +53,26 @@ extern size_t stringc;          // Defined in ir.c, used by generator.c
 /* Global routines, called from main in vslc.c */
 void simplify_syntax_tree ( void );
 void print_syntax_tree ( void );
+void print_rewrite_statistics ( void );
 void destroy_syntax_tree ( void );
 
+/* Folding of constants in trees that are already simplified, used by
+ * the optimizations in optimizer.c */
+void fold_subtree ( node_t **slot );
+/* Computes x op y for a binary operator, false if the machine would trap */
+bool fold_constants ( char op, int64_t x, int64_t y, int64_t *result );
+
 void create_symbol_table ( void );
 void print_symbol_table ( void );
 void destroy_symbol_table ( void );
 
+void optimize_syntax_tree ( void );
+
+void print_ssa_program ( void );
+
 void generate_program ( void );
 
+/* Rewrites and prints the assembly of a function, called from generator.c */
+void optimize_function_assembly ( char *text );
+
 #endif
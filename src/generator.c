@@ -8,9 +8,9 @@ struct compilation_target_t {
     node_t *node;
     // The function the node is contained within
     symbol_t *function;
-    // The current stack alignment, i.e. how many bytes we've pushed
-    // on the stack at this point
-    unsigned int *stack_alignment;
+    // The index of the first temporary slot not in use at this point.
+    // Temporaries are used for intermediate values of expressions
+    unsigned int temporary;
     // If a return statement has been added
     bool *returned;
     // The target destination of the value of this node, such as a
@@ -22,67 +22,243 @@ struct compilation_target_t {
     char *surrounding_loop_label;
 };
 
-/**Generate table of strings in a rodata section. */
+/**Generate table of constant strings in a rodata section. */
 static void generate_stringtable(void);
 /**Declare global variables in a bss section */
 static void generate_global_variables(size_t n_globals, symbol_t **global_list);
+/**Finds the function the program starts in, which is the one called main or
+ * else the first one defined
+ * @param n_globals the number of global symbols
+ * @param global_list the global symbols
+ * @return the function, or NULL if there are none */
+static symbol_t *find_main_function(size_t n_globals, symbol_t **global_list);
+/**Adds the functions called from a subtree, and the ones they call, to a table
+ * @param node the subtree
+ * @param reachable table of the functions found so far */
+static void find_reachable_functions(node_t *node, tlhash_t *reachable);
 /**Declare global variables in a bss section */
-static void generate_functions(symbol_t **main, size_t n_globals, symbol_t **global_list);
+static void generate_functions(tlhash_t *reachable, size_t n_globals, symbol_t **global_list);
 /**Generate function entry code
  * @param function symbol table entry of function */
 static void generate_function(symbol_t *function);
 static void generate_node(struct compilation_target_t target);
+/**Generates a function from its SSA form, see ssa.c
+ * @param function symbol table entry of function */
+static void generate_ssa_function(symbol_t *function);
 /**Initializes program (already implemented) */
 static void generate_main(symbol_t *first);
+/**Generates the System V entry point of a function that uses the private
+ * calling convention, so it can be called from main
+ * @param function Symbol table entry of the function */
+static void generate_abi_wrapper(symbol_t *function);
+/**Finds the functions whose results are kept in a table, see generate_memo_wrapper
+ * @param reachable the functions that can be reached from main
+ * @param n_globals the number of global symbols
+ * @param global_list the global symbols */
+static void find_memoized_functions(tlhash_t *reachable, size_t n_globals, symbol_t **global_list);
+/**Generates the entry point of a memoized function, which looks the arguments
+ * up in the table of results before calling the body of the function
+ * @param function Symbol table entry of the function */
+static void generate_memo_wrapper(symbol_t *function);
+/**Generate table of constant text printed by print statements in a rodata section */
+static void generate_text_table(void);
+/**Generate the run-time routines used for output */
+static void generate_runtime(void);
 
 // Prefix for all functions that are compiled
 #define FUNC_PREFIX "_func_"
+// Prefix of functions using the private calling convention, which are only
+// called from other VSL functions
+#define PRIVATE_FUNC_PREFIX "_vsl_func_"
 #define LABEL_MAX_SIZE 128
 
-// Macros that avoid evaluating twice
-#define MIN(a, b) \
-    ({ __typeof__ (a) _a = (a); \
-       __typeof__ (b) _b = (b); \
-     _a < _b ? _a : _b; })
-
-#define MAX(a, b) \
-    ({ __typeof__ (a) _a = (a); \
-       __typeof__ (b) _b = (b); \
-     _a > _b ? _a : _b; })
-
 static const char *PARAMETER_REGISTERS[6] = {
     "%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
 
+// The private calling convention also passes arguments in the registers
+// that System V has the callee preserve. Generated code never keeps a value
+// in a register across a call, so all registers may be clobbered by a call
+// and there is nothing for the callee to preserve
+static const char *PRIVATE_PARAMETER_REGISTERS[11] = {
+    "%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9", "%rbx", "%r12", "%r13", "%r14", "%r15"};
+
+// How arguments are passed to the generated functions
+struct calling_convention_t {
+    // Prefix of the function labels
+    const char *prefix;
+    // Arguments passed in registers, the rest are passed on the stack
+    const char **registers;
+    size_t n_registers;
+    // If the stack has to be aligned to 16 bytes at calls
+    bool aligned;
+};
+
+static const struct calling_convention_t SYSTEM_V_CONVENTION = {
+    .prefix = FUNC_PREFIX,
+    .registers = PARAMETER_REGISTERS,
+    .n_registers = 6,
+    .aligned = true};
+
+// The run-time makes system calls directly, so nothing that can be reached
+// from a generated function calls into the C library. The stack therefore
+// never has to be aligned
+static const struct calling_convention_t PRIVATE_CONVENTION = {
+    .prefix = PRIVATE_FUNC_PREFIX,
+    .registers = PRIVATE_PARAMETER_REGISTERS,
+    .n_registers = 11,
+    .aligned = false};
+
+static const struct calling_convention_t *convention = &SYSTEM_V_CONVENTION;
+
+// How the frame of a function is set up
+enum frame_kind_t {
+    // Saved %rbp, which the slots are addressed relative to
+    FRAME_POINTER,
+    // No frame at all, leaf functions keep their slots in the red zone
+    // below %rsp
+    FRAME_RED_ZONE,
+    // Frame allocated below the return address without saving %rbp,
+    // with the slots addressed relative to %rsp
+    FRAME_STACK_POINTER
+};
+
+// Layout of the frame of the function currently being generated
+struct frame_t {
+    enum frame_kind_t kind;
+    // Bytes allocated below the return address, excluding a saved %rbp
+    size_t size;
+};
+
+static struct frame_t frame;
+
+// The System V ABI guarantees that the 128 bytes below %rsp are left
+// alone by signal handlers
+#define RED_ZONE_SIZE 128
+
+// Set by the -fomit-frame-pointer flag, defined in vslc.c
+extern bool omit_frame_pointer;
+// Set by the -falign-loops=<n> flag, defined in vslc.c. Rounded down to a
+// power of two, a value of 1 or less disables the alignment
+extern int loop_alignment;
+// Set by the -fprivate-calls flag, defined in vslc.c
+extern bool private_calls;
+// Set by the -fpromote-globals flag, defined in vslc.c
+extern bool promote_globals;
+// Set by the -fssa flag, defined in vslc.c
+extern bool use_ssa;
+
+// A global variable that is kept in a register throughout a region of code
+// without calls, instead of being accessed in memory
+struct promoted_global_t {
+    symbol_t *symbol;
+    const char *reg;
+    size_t uses;
+    // Only written globals have to be stored back when leaving the region
+    bool written;
+};
+
+// Generated code only uses these registers to pass arguments, so they are
+// free in regions without calls and prints
+static const char *PROMOTION_REGISTERS[5] = {"%rcx", "%rsi", "%rdi", "%r8", "%r9"};
+#define MAX_PROMOTED_GLOBALS 5
+
+// The globals promoted in the region currently being generated, if any
+static struct promoted_global_t promoted_globals[MAX_PROMOTED_GLOBALS];
+static size_t n_promoted_globals = 0;
+// Set by the -fif-conversion flag, defined in vslc.c
+extern bool if_conversion;
+// Set by the -fif-conversion-limit=<n> flag, defined in vslc.c. The cost of
+// the work done for the branch that is not taken when using a conditional move
+extern int if_conversion_limit;
+// Set by the -fmemoize and -fmemoize-stats flags, defined in vslc.c
+extern bool memoize;
+extern bool memoize_stats;
+// Set by the -funroll-loops flag, defined in vslc.c
+extern bool unroll_loops;
+// Set by the -funroll-factor=<n> and -funroll-limit=<n> flags, defined in
+// vslc.c. How many copies of the body an unrolled loop has, and how many
+// syntax tree nodes a body may have to be unrolled
+extern int unroll_factor;
+extern int unroll_limit;
+
+// Functions whose results are kept in a table, keyed by the symbol pointer.
+// The table is direct mapped, with entries of a valid flag, the arguments
+// and the result
+static tlhash_t memoized;
+static bool any_memoized = false;
+#define MEMO_TABLE_BITS 12
+#define MEMO_ENTRY_BITS 5
+// Suffix of the label of the body of a memoized function. No name in VSL
+// can contain a '.', so it can't clash with another function
+#define MEMO_BODY_SUFFIX ".body"
+
+// Constant text of print statements, collected while generating the
+// functions and emitted after them
+static char **text_list = NULL;
+static size_t textc = 0, n_text_list = 0;
+
+// Size of the run-time output buffer, which is flushed with write(2)
+#define OUTPUT_BUFFER_SIZE 65536
+// Linux system call numbers used by the run-time
+#define SYS_WRITE 1
+#define EINTR 4
+
 void generate_program(void) {
     symbol_t *main;
 
+    convention = private_calls ? &PRIVATE_CONVENTION : &SYSTEM_V_CONVENTION;
+
     generate_stringtable();
 
     size_t n_globals = tlhash_size(global_names);
     symbol_t **global_list = malloc(sizeof(symbol_t *) * n_globals);
     tlhash_values(global_names, (void **)global_list);
 
+    main = find_main_function(n_globals, global_list);
+
+    // Functions that can't be reached from main are never run
+    tlhash_t reachable;
+    tlhash_init(&reachable, 32);
+    if (main != NULL) {
+        tlhash_insert(&reachable, &main, sizeof(symbol_t *), main);
+        find_reachable_functions(main->node, &reachable);
+    }
+
+    find_memoized_functions(&reachable, n_globals, global_list);
     generate_global_variables(n_globals, global_list);
-    generate_functions(&main, n_globals, global_list);
+    generate_functions(&reachable, n_globals, global_list);
+
+    // Only the function called from main has to follow the System V ABI
+    if (convention != &SYSTEM_V_CONVENTION) {
+        generate_abi_wrapper(main);
+    }
 
     generate_main(main);
+    generate_runtime();
+    generate_text_table();
 
+    tlhash_finalize(&reachable);
+    tlhash_finalize(&memoized);
     free(global_list);
 }
 
 void generate_stringtable(void) {
-    /* These can be used to emit numbers, strings and a run-time
-     * error msg. from main
+    /* Run-time error msg. from main. The string literals of the program are
+     * baked into the printed text, see generate_text_table
      */
     puts(".section .rodata");
-    puts(".newline:\n\t.asciz \"\\n\"");
-    puts(".intout:\n\t.asciz \"\%ld \"");
-    puts(".strout:\n\t.asciz \"\%s \"");
     puts(".errout:\n\t.asciz \"Wrong number of arguments\"");
+}
 
-    for (size_t i = 0; i < stringc; i++) {
-        printf(".STR%lu:\n\t.asciz %s\n", i, string_list[i]);
+void generate_text_table(void) {
+    puts(".section .rodata");
+
+    // The text is not terminated, the end label is used to get its length
+    for (size_t i = 0; i < textc; i++) {
+        printf(".TXT%lu:\n\t.ascii \"%s\"\n.TXT%lu_END:\n", i, text_list[i], i);
+        free(text_list[i]);
     }
+    free(text_list);
 }
 
 void generate_global_variables(size_t n_globals, symbol_t **global_list) {
@@ -98,73 +274,242 @@ void generate_global_variables(size_t n_globals, symbol_t **global_list) {
 
         printf(".%s: .zero 8\n", sym->name);
     }
-}
 
-void generate_functions(symbol_t **main, size_t n_globals, symbol_t **global_list) {
-    *main = NULL;
-    bool main_lock = false;
-
-    puts(".section .text");
-
-    symbol_t *sym;
+    void *found;
     for (size_t i = 0; i < n_globals; i++) {
         sym = global_list[i];
-        if (sym->type != SYM_FUNCTION) {
+        if (tlhash_lookup(&memoized, &sym, sizeof(symbol_t *), &found) != TLHASH_SUCCESS) {
             continue;
         }
 
-        bool is_main = !strncmp("main", sym->name, 6);
-        if (is_main || !main_lock && (*main == NULL || (*main)->seq > sym->seq)) {
-            *main = sym;
-            main_lock = is_main;
+        printf("_vsl_memo_%s: .zero %d\n", sym->name, 1 << (MEMO_ENTRY_BITS + MEMO_TABLE_BITS));
+        if (memoize_stats) {
+            printf("_vsl_memo_%s_hits: .zero 8\n", sym->name);
+            printf("_vsl_memo_%s_misses: .zero 8\n", sym->name);
         }
-
-        generate_function(sym);
     }
 }
 
-static unsigned int allocate_aligned_stack(size_t slots, unsigned int *stack_alignment) {
-    *stack_alignment += slots * 8;
+static void find_reachable_functions(node_t *node, tlhash_t *reachable) {
+    if (node == NULL) {
+        return;
+    }
 
-    unsigned int offset = 0;
-    if ((*stack_alignment) % 16 != 0) {
-        offset = 16 - ((*stack_alignment) % 16);
-        *stack_alignment += offset;
+    if (is_call(node)) {
+        symbol_t *callee = node->children[0]->entry;
+        if (tlhash_insert(reachable, &callee, sizeof(symbol_t *), callee) == TLHASH_SUCCESS) {
+            find_reachable_functions(callee->node, reachable);
+        }
     }
 
-    if (offset == 0 && slots == 0) {
-        return 0;
+    for (size_t i = 0; i < node->n_children; i++) {
+        find_reachable_functions(node->children[i], reachable);
+    }
+}
+
+/**Checks if a function can neither be affected by nor affect anything but
+ * its arguments and result, as far as is known so far
+ * @param node subtree of the body of the function
+ * @param impure functions known not to be pure */
+static bool is_pure(node_t *node, tlhash_t *impure) {
+    if (node == NULL) {
+        return true;
+    }
+
+    void *found;
+    switch (node->type) {
+        case PRINT_STATEMENT:
+            return false;
+        case IDENTIFIER_DATA:
+            // Reading a global is not allowed either, since its value may
+            // differ between calls with the same arguments
+            if (node->entry != NULL && node->entry->type == SYM_GLOBAL_VAR) {
+                return false;
+            }
+            if (node->entry != NULL && node->entry->type == SYM_FUNCTION &&
+                tlhash_lookup(impure, &node->entry, sizeof(symbol_t *), &found) == TLHASH_SUCCESS) {
+                return false;
+            }
+            break;
+        default:
+            break;
     }
 
-    printf("\tsubq $%lu, %%rsp\n", slots * 8 + offset);
-    return offset;
+    for (size_t i = 0; i < node->n_children; i++) {
+        if (!is_pure(node->children[i], impure)) {
+            return false;
+        }
+    }
+    return true;
 }
 
-static void allocate_stack(size_t slots, unsigned int *stack_alignment) {
-    if (slots == 0) {
+static void find_memoized_functions(tlhash_t *reachable, size_t n_globals, symbol_t **global_list) {
+    tlhash_init(&memoized, 8);
+    if (!memoize) {
         return;
     }
 
-    *stack_alignment += slots * 8;
-    printf("\tsubq $%lu, %%rsp\n", slots * 8);
+    // Functions are assumed to be pure until shown otherwise, which
+    // handles recursion. Repeated until no more impure functions are found
+    tlhash_t impure;
+    tlhash_init(&impure, 32);
+    bool changed = true;
+    symbol_t *sym;
+    void *found;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < n_globals; i++) {
+            sym = global_list[i];
+            if (sym->type != SYM_FUNCTION ||
+                tlhash_lookup(&impure, &sym, sizeof(symbol_t *), &found) == TLHASH_SUCCESS) {
+                continue;
+            }
+
+            if (!is_pure(sym->node, &impure)) {
+                tlhash_insert(&impure, &sym, sizeof(symbol_t *), sym);
+                changed = true;
+            }
+        }
+    }
+
+    // Only recursive functions can repeat the same calls often enough for
+    // the table to pay off. The tables of functions that are never run
+    // would only take up space
+    for (size_t i = 0; i < n_globals; i++) {
+        sym = global_list[i];
+        if (sym->type != SYM_FUNCTION || sym->nparms < 1 || sym->nparms > 2 ||
+            tlhash_lookup(reachable, &sym, sizeof(symbol_t *), &found) != TLHASH_SUCCESS ||
+            tlhash_lookup(&impure, &sym, sizeof(symbol_t *), &found) == TLHASH_SUCCESS) {
+            continue;
+        }
+
+        tlhash_t callees;
+        tlhash_init(&callees, 32);
+        find_reachable_functions(sym->node, &callees);
+        if (tlhash_lookup(&callees, &sym, sizeof(symbol_t *), &found) == TLHASH_SUCCESS) {
+            tlhash_insert(&memoized, &sym, sizeof(symbol_t *), sym);
+            any_memoized = true;
+        }
+        tlhash_finalize(&callees);
+    }
+
+    tlhash_finalize(&impure);
 }
 
-static unsigned int align_stack(unsigned int *stack_alignment) {
-    // Stack is already aligned
-    if ((*stack_alignment) % 16 == 0) {
-        return 0;
+static void generate_memo_wrapper(symbol_t *function) {
+    char *name = function->name;
+    const char **registers = convention->registers;
+
+    if (convention == &SYSTEM_V_CONVENTION) {
+        printf(".globl %s%s\n", convention->prefix, name);
+    }
+    printf("%s%s:\n", convention->prefix, name);
+
+    // Fibonacci hashing of the arguments, the top bits pick the entry. The
+    // multiplier needs all 64 bits, or small arguments all get the same bits
+    puts("\tmovabsq $0x9e3779b97f4a7c15, %rdx");
+    printf("\tmovq %s, %%rax\n", registers[0]);
+    puts("\timulq %rdx, %rax");
+    if (function->nparms == 2) {
+        printf("\taddq %s, %%rax\n", registers[1]);
+        puts("\timulq %rdx, %rax");
+    }
+    printf("\tshrq $%d, %%rax\n", 64 - MEMO_TABLE_BITS);
+    printf("\tshlq $%d, %%rax\n", MEMO_ENTRY_BITS);
+    printf("\tleaq _vsl_memo_%s(%%rax), %%rcx\n", name);
+
+    puts("\tcmpq $0, (%rcx)");
+    printf("\tje .Lvsl_memo_%s_miss\n", name);
+    for (size_t i = 0; i < function->nparms; i++) {
+        printf("\tcmpq %s, %lu(%%rcx)\n", registers[i], 8 * (i + 1));
+        printf("\tjne .Lvsl_memo_%s_miss\n", name);
     }
+    if (memoize_stats) {
+        printf("\tincq _vsl_memo_%s_hits\n", name);
+    }
+    puts("\tmovq 24(%rcx), %rax");
+    puts("\tret");
 
-    unsigned int offset = 16 - ((*stack_alignment) % 16);
-    *stack_alignment += offset;
-    printf("\tsubq $%d, %%rsp\n", offset);
-    return offset;
+    // The arguments and the entry are kept on the stack across the call of
+    // the body, which keeps the stack aligned as it was at the call
+    printf(".Lvsl_memo_%s_miss:\n", name);
+    if (memoize_stats) {
+        printf("\tincq _vsl_memo_%s_misses\n", name);
+    }
+    puts("\tsubq $24, %rsp");
+    for (size_t i = 0; i < function->nparms; i++) {
+        printf("\tmovq %s, %lu(%%rsp)\n", registers[i], 8 * i);
+    }
+    puts("\tmovq %rcx, 16(%rsp)");
+    printf("\tcall %s%s%s\n", convention->prefix, name, MEMO_BODY_SUFFIX);
+    puts("\tmovq 16(%rsp), %rcx");
+    puts("\tmovq $1, (%rcx)");
+    for (size_t i = 0; i < function->nparms; i++) {
+        printf("\tmovq %lu(%%rsp), %%rdx\n", 8 * i);
+        printf("\tmovq %%rdx, %lu(%%rcx)\n", 8 * (i + 1));
+    }
+    puts("\tmovq %rax, 24(%rcx)");
+    puts("\taddq $24, %rsp");
+    puts("\tret");
 }
 
-static void unalign_stack(unsigned int alignment, unsigned int *stack_alignment) {
-    if (alignment != 0) {
-        printf("\taddq $%d, %%rsp\n", alignment);
-        *stack_alignment -= alignment;
+symbol_t *find_main_function(size_t n_globals, symbol_t **global_list) {
+    symbol_t *main = NULL;
+    bool main_lock = false;
+
+    symbol_t *sym;
+    for (size_t i = 0; i < n_globals; i++) {
+        sym = global_list[i];
+        if (sym->type != SYM_FUNCTION) {
+            continue;
+        }
+
+        bool is_main = !strncmp("main", sym->name, 6);
+        if (is_main || !main_lock && (main == NULL || main->seq > sym->seq)) {
+            main = sym;
+            main_lock = is_main;
+        }
+    }
+
+    return main;
+}
+
+void generate_functions(tlhash_t *reachable, size_t n_globals, symbol_t **global_list) {
+    symbol_t *sym;
+    void *found;
+    for (size_t i = 0; i < n_globals; i++) {
+        sym = global_list[i];
+        if (sym->type != SYM_FUNCTION) {
+            continue;
+        }
+
+        // Functions that are never run are kept away from the rest of the code
+        if (tlhash_lookup(reachable, &sym, sizeof(symbol_t *), &found) == TLHASH_SUCCESS) {
+            puts(".section .text");
+        } else {
+            puts(".section .text.unlikely");
+        }
+
+        if (tlhash_lookup(&memoized, &sym, sizeof(symbol_t *), &found) == TLHASH_SUCCESS) {
+            generate_memo_wrapper(sym);
+        }
+
+        // The function is generated into a buffer first, so its instructions
+        // can be improved before they are written out
+        FILE *output = stdout;
+        char *text;
+        size_t text_size;
+        stdout = open_memstream(&text, &text_size);
+        if (use_ssa) {
+            generate_ssa_function(sym);
+        } else {
+            generate_function(sym);
+        }
+        fclose(stdout);
+        stdout = output;
+
+        optimize_function_assembly(text);
+        free(text);
     }
 }
 
@@ -176,12 +521,39 @@ static void label_here(char *buf) {
     printf("%s:\n", buf);
 }
 
+/**Writes the memory operand of a slot in the current frame. Slots are
+ * numbered downwards from where %rbp points in a conventional frame, i.e.
+ * just below the return address and saved %rbp
+ * @param buf buffer to write the operand to
+ * @param bufsize size of the buffer
+ * @param slot the slot to access */
+static void write_slot_accessor(char *buf, size_t bufsize, int slot) {
+    int offset = (slot + 1) * -8;
+
+    switch (frame.kind) {
+        case FRAME_POINTER:
+            snprintf(buf, bufsize, "%d(%%rbp)", offset);
+            break;
+        case FRAME_RED_ZONE:
+            // Nothing has been pushed, so %rsp points at the return address
+            snprintf(buf, bufsize, "%d(%%rsp)", offset - 8);
+            break;
+        case FRAME_STACK_POINTER:
+            snprintf(buf, bufsize, "%d(%%rsp)", offset - 8 + (int)frame.size);
+            break;
+    }
+}
+
 static void move_reg_to_slot(const char *reg, int slot) {
-    printf("\tmovq %s, %d(%%rbp)\n", reg, (slot + 1) * -8);
+    char slot_accessor[32];
+    write_slot_accessor(slot_accessor, 32, slot);
+    printf("\tmovq %s, %s\n", reg, slot_accessor);
 }
 
 static void move_slot_to_reg(const char *reg, int slot) {
-    printf("\tmovq %d(%%rbp), %s\n", (slot + 1) * -8, reg);
+    char slot_accessor[32];
+    write_slot_accessor(slot_accessor, 32, slot);
+    printf("\tmovq %s, %s\n", slot_accessor, reg);
 }
 
 static void move_reg_to_global(const char *reg, char *global) {
@@ -198,43 +570,412 @@ static size_t get_variable_count(symbol_t *function) {
 
 static int get_slot(symbol_t *function, symbol_t *sym) {
     if (sym->type == SYM_PARAMETER) {
-        return MIN(5, function->nparms - 1) - sym->seq;
+        // Parameters not passed in registers are on the stack, above the
+        // return address and saved %rbp, which take up two slots
+        int n_registers = convention->n_registers;
+        if (sym->seq >= n_registers) {
+            return n_registers - 3 - (int)sym->seq;
+        }
+
+        return MIN(n_registers - 1, function->nparms - 1) - sym->seq;
     }
 
-    return sym->seq + MIN(6, function->nparms);
+    return sym->seq + MIN(convention->n_registers, function->nparms);
 }
 
-void generate_function(symbol_t *function) {
-    printf(".globl %s%s\n", FUNC_PREFIX, function->name);
-    printf("%s%s:\n", FUNC_PREFIX, function->name);
-    // Initialize stack frame
-    puts("\tpushq %rbp");
-    puts("\tmovq %rsp, %rbp");
+static int get_temporary_slot(symbol_t *function, unsigned int temporary) {
+    return MIN(convention->n_registers, function->nparms) + get_variable_count(function) + temporary;
+}
 
-    // The amount of parameters that are not yet on the stack
-    size_t paramc = MIN(6, function->nparms);
+// An if-statement that only picks which of two values to assign to a variable
+struct conditional_move_t {
+    node_t *relation;
+    node_t *variable;
+    node_t *then_value;
+    // The variable itself if the if-statement has no else-branch
+    node_t *else_value;
+};
 
-    // At this stage the stack is aligned, since we've got
-    // return address and rbp pushed.
-    unsigned int stack_alignment = 0;
-    unsigned int mangle_index = 0;
-    bool returned = false;
-    allocate_stack(paramc + get_variable_count(function), &stack_alignment);
+static bool is_leaf(node_t *node) {
+    return node->type == NUMBER_DATA || node->type == IDENTIFIER_DATA;
+}
+
+/**Finds the cost of computing an expression that might not be needed
+ * @param node the expression
+ * @return the cost, or -1 if the expression can not be computed ahead of
+ *         time because it has side effects or may trap */
+static int speculation_cost(node_t *node) {
+    if (is_leaf(node)) {
+        return 0;
+    }
+
+    if (node->type != EXPRESSION || node->data == NULL) {
+        return -1;
+    }
+
+    int cost = 1;
+    switch (*((char *)node->data)) {
+        case '*':
+            cost = 3;
+            break;
+        case '/':
+            // Division by zero and of the smallest value by -1 traps
+            if (node->children[1]->type != NUMBER_DATA) {
+                return -1;
+            }
+
+            int64_t divisor = *((int64_t *)node->children[1]->data);
+            if (divisor == 0 || divisor == -1) {
+                return -1;
+            }
+            cost = 20;
+            break;
+    }
+
+    for (size_t i = 0; i < node->n_children; i++) {
+        int child_cost = speculation_cost(node->children[i]);
+        if (child_cost < 0) {
+            return -1;
+        }
+        cost += child_cost;
+    }
+    return cost;
+}
+
+/**Finds the single assignment a branch of an if-statement consists of
+ * @param node the branch
+ * @return the assignment, or NULL if there is anything else in the branch */
+static node_t *single_assignment(node_t *node) {
+    while ((node->type == BLOCK || node->type == STATEMENT_LIST) && node->n_children == 1) {
+        node = node->children[0];
+    }
+
+    return node->type == ASSIGNMENT_STATEMENT ? node : NULL;
+}
+
+/**Checks if an if-statement can be generated with a conditional move
+ * instead of branches
+ * @param node the node to check
+ * @param move filled in with the parts of the conditional move */
+static bool find_conditional_move(node_t *node, struct conditional_move_t *move) {
+    if (!if_conversion || node->type != IF_STATEMENT) {
+        return false;
+    }
+
+    node_t *then_assignment = single_assignment(node->children[1]);
+    if (then_assignment == NULL) {
+        return false;
+    }
+
+    move->relation = node->children[0];
+    move->variable = then_assignment->children[0];
+    move->then_value = then_assignment->children[1];
+    move->else_value = move->variable;
+
+    if (node->n_children == 3) {
+        node_t *else_assignment = single_assignment(node->children[2]);
+        if (else_assignment == NULL || else_assignment->children[0]->entry != move->variable->entry) {
+            return false;
+        }
+        move->else_value = else_assignment->children[1];
+    }
+
+    // Both values are computed, only one of them would have been otherwise
+    int then_cost = speculation_cost(move->then_value);
+    int else_cost = speculation_cost(move->else_value);
+    return then_cost >= 0 && else_cost >= 0 && then_cost + else_cost <= if_conversion_limit;
+}
+
+/**Finds the number of temporary slots needed to generate a node. This has to
+ * mirror how generate_expression and generate_conditional use them
+ * @param node the node to generate */
+static unsigned int count_temporaries(node_t *node) {
+    if (node == NULL) {
+        return 0;
+    }
+
+    // The right hand side of an expression (left hand side for relations)
+    // is kept in a temporary while the other side is computed
+    if (node->type == EXPRESSION && node->data != NULL && node->n_children == 2) {
+        return MAX(count_temporaries(node->children[1]), 1 + count_temporaries(node->children[0]));
+    }
+
+    if (node->type == RELATION) {
+        return MAX(count_temporaries(node->children[0]), 1 + count_temporaries(node->children[1]));
+    }
+
+    // The computed values of a conditional move are kept in temporaries
+    // while the condition is evaluated
+    struct conditional_move_t move;
+    if (find_conditional_move(node, &move)) {
+        unsigned int temporaries = 0, kept = 0;
+        if (!is_leaf(move.then_value)) {
+            temporaries = MAX(temporaries, count_temporaries(move.then_value));
+            kept++;
+        }
+        if (!is_leaf(move.else_value)) {
+            temporaries = MAX(temporaries, kept + count_temporaries(move.else_value));
+            kept++;
+        }
+        return MAX(temporaries, kept + count_temporaries(move.relation));
+    }
+
+    // Each argument of a call may be kept in its own temporary, and is
+    // evaluated with the ones in front of it in use
+    if (is_call(node) && node->children[1] != NULL) {
+        node_t *arguments = node->children[1];
+        unsigned int temporaries = 0;
+        for (size_t i = 0; i < arguments->n_children; i++) {
+            temporaries = MAX(temporaries, i + MAX(1, count_temporaries(arguments->children[i])));
+        }
+        return temporaries;
+    }
+
+    unsigned int temporaries = 0;
+    for (size_t i = 0; i < node->n_children; i++) {
+        temporaries = MAX(temporaries, count_temporaries(node->children[i]));
+    }
+    return temporaries;
+}
+
+/**Finds the number of slots needed for arguments passed on the stack
+ * by the function calls inside a node
+ * @param node the node to generate */
+static size_t count_outgoing_arguments(node_t *node) {
+    if (node == NULL) {
+        return 0;
+    }
+
+    size_t arguments = 0;
+    if (is_call(node)) {
+        symbol_t *func = node->children[0]->entry;
+        arguments = MAX(convention->n_registers, func->nparms) - convention->n_registers;
+    }
+
+    for (size_t i = 0; i < node->n_children; i++) {
+        arguments = MAX(arguments, count_outgoing_arguments(node->children[i]));
+    }
+    return arguments;
+}
+
+/**Checks if a node calls anything, either a function or the run-time
+ * through a print statement
+ * @param node the node to check */
+static bool makes_calls(node_t *node) {
+    if (node == NULL) {
+        return false;
+    }
+
+    if (is_call(node) || node->type == PRINT_STATEMENT) {
+        return true;
+    }
+
+    for (size_t i = 0; i < node->n_children; i++) {
+        if (makes_calls(node->children[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The globals used inside a region of code
+struct global_uses_t {
+    struct promoted_global_t *globals;
+    size_t count;
+    size_t capacity;
+};
+
+static void find_global_uses(node_t *node, struct global_uses_t *uses) {
+    if (node == NULL) {
+        return;
+    }
+
+    // Declarations are skipped, their identifiers are not bound to symbols
+    if (node->type == DECLARATION) {
+        return;
+    }
+
+    if (node->type == IDENTIFIER_DATA && ((symbol_t *)node->entry)->type == SYM_GLOBAL_VAR) {
+        size_t i = 0;
+        while (i < uses->count && uses->globals[i].symbol != node->entry) {
+            i++;
+        }
+
+        if (i == uses->count) {
+            if (uses->count == uses->capacity) {
+                uses->capacity = uses->capacity == 0 ? 8 : uses->capacity * 2;
+                uses->globals = realloc(uses->globals, uses->capacity * sizeof(struct promoted_global_t));
+            }
+            uses->globals[uses->count++] = (struct promoted_global_t){.symbol = node->entry};
+        }
+        uses->globals[i].uses++;
+    }
+
+    // The target of an assignment is the first child
+    if (is_assignment(node)) {
+        find_global_uses(node->children[0], uses);
+        for (size_t i = 0; i < uses->count; i++) {
+            if (uses->globals[i].symbol == node->children[0]->entry) {
+                uses->globals[i].written = true;
+            }
+        }
+
+        find_global_uses(node->children[1], uses);
+        return;
+    }
+
+    for (size_t i = 0; i < node->n_children; i++) {
+        find_global_uses(node->children[i], uses);
+    }
+}
+
+static int compare_global_uses(const void *a, const void *b) {
+    size_t uses_a = ((const struct promoted_global_t *)a)->uses;
+    size_t uses_b = ((const struct promoted_global_t *)b)->uses;
+    return uses_a < uses_b ? 1 : uses_a > uses_b ? -1 : 0;
+}
+
+/**Loads the most used globals of a region without calls into registers,
+ * unless a surrounding region already did
+ * @param region the node containing all code of the region
+ * @param min_uses how many times a global has to be used to be worth it
+ * @return if the region got any globals promoted */
+static bool begin_global_promotion(node_t *region, size_t min_uses) {
+    if (!promote_globals || n_promoted_globals != 0 || makes_calls(region)) {
+        return false;
+    }
+
+    struct global_uses_t uses = {0};
+    find_global_uses(region, &uses);
+    if (uses.count == 0) {
+        return false;
+    }
+    qsort(uses.globals, uses.count, sizeof(struct promoted_global_t), compare_global_uses);
+
+    for (size_t i = 0; i < uses.count && n_promoted_globals < MAX_PROMOTED_GLOBALS; i++) {
+        if (uses.globals[i].uses < min_uses) {
+            break;
+        }
+
+        struct promoted_global_t *global = &promoted_globals[n_promoted_globals];
+        *global = uses.globals[i];
+        global->reg = PROMOTION_REGISTERS[n_promoted_globals++];
+        move_global_to_reg(global->reg, global->symbol->name);
+    }
+
+    free(uses.globals);
+    return n_promoted_globals != 0;
+}
+
+/**Stores the promoted globals that have been written back to memory, which
+ * has to happen whenever the region is left */
+static void store_promoted_globals(void) {
+    for (size_t i = 0; i < n_promoted_globals; i++) {
+        if (promoted_globals[i].written) {
+            move_reg_to_global(promoted_globals[i].reg, promoted_globals[i].symbol->name);
+        }
+    }
+}
+
+static const char *get_promoted_register(symbol_t *sym) {
+    for (size_t i = 0; i < n_promoted_globals; i++) {
+        if (promoted_globals[i].symbol == sym) {
+            return promoted_globals[i].reg;
+        }
+    }
+    return NULL;
+}
+
+static void generate_epilogue(void) {
+    switch (frame.kind) {
+        case FRAME_POINTER:
+            puts("\tleave");
+            break;
+        case FRAME_RED_ZONE:
+            break;
+        case FRAME_STACK_POINTER:
+            if (frame.size != 0) {
+                printf("\taddq $%lu, %%rsp\n", frame.size);
+            }
+            break;
+    }
+    puts("\tret");
+}
+
+/**Emits the entry of a function, setting up its frame and moving the
+ * parameters passed in registers into their slots
+ * @param function symbol table entry of the function
+ * @param slots the number of slots the frame needs
+ * @param calls if the function calls anything */
+static void generate_prologue(symbol_t *function, size_t slots, bool calls) {
+    // Calls of memoized functions go through the wrapper checking the table
+    void *found;
+    if (tlhash_lookup(&memoized, &function, sizeof(symbol_t *), &found) == TLHASH_SUCCESS) {
+        printf("%s%s%s:\n", convention->prefix, function->name, MEMO_BODY_SUFFIX);
+    } else {
+        if (convention == &SYSTEM_V_CONVENTION) {
+            printf(".globl %s%s\n", convention->prefix, function->name);
+        }
+        printf("%s%s:\n", convention->prefix, function->name);
+    }
+
+    // With the return address and rbp pushed the stack is aligned. Keep it
+    // that way so that we never have to align it in front of a call
+    frame.size = convention->aligned ? (slots * 8 + 15) & ~15 : slots * 8;
+
+    // Leaf functions don't need to keep the stack aligned, and as long as
+    // their slots fit in the red zone they don't need a frame at all. The
+    // slot where %rbp would have been saved is left unused
+    if (!calls && (slots + 1) * 8 <= RED_ZONE_SIZE) {
+        frame.kind = FRAME_RED_ZONE;
+        frame.size = 0;
+    } else if (omit_frame_pointer) {
+        // Without rbp pushed, the frame has to cover its slot as well, which
+        // is where the slots are addressed from
+        frame.kind = FRAME_STACK_POINTER;
+        frame.size += 8;
+        printf("\tsubq $%lu, %%rsp\n", frame.size);
+    } else {
+        frame.kind = FRAME_POINTER;
+        puts("\tpushq %rbp");
+        puts("\tmovq %rsp, %rbp");
+        if (frame.size != 0) {
+            printf("\tsubq $%lu, %%rsp\n", frame.size);
+        }
+    }
 
     // Move this in right to left order so that parameter 0
     // is at the top of the stack. This also means that our
     // parameters will be in order on the stack, with 0 at
     // the top.
+    size_t paramc = MIN(convention->n_registers, function->nparms);
     for (int param = 0; param < paramc; param++) {
-        move_reg_to_slot(PARAMETER_REGISTERS[paramc - param - 1], param);
+        move_reg_to_slot(convention->registers[paramc - param - 1], param);
     }
+}
+
+void generate_function(symbol_t *function) {
+    // The frame holds the parameters passed in registers, the local variables
+    // and the temporaries, with the arguments of calls we make at the bottom.
+    // It is allocated once here, so %rsp stays put throughout the function
+    size_t slots = MIN(convention->n_registers, function->nparms) + get_variable_count(function) +
+                   count_temporaries(function->node) + count_outgoing_arguments(function->node);
+    generate_prologue(function, slots, makes_calls(function->node));
+
+    unsigned int mangle_index = 0;
+    bool returned = false;
 
     // All parameters are now on the stack
 
+    // In functions without calls the globals used more than once can be kept
+    // in registers from here on
+    n_promoted_globals = 0;
+    begin_global_promotion(function->node, 2);
+
     struct compilation_target_t target = {
         .function = function,
         .node = function->node,
-        .stack_alignment = &stack_alignment,
+        .temporary = 0,
         .target_destination = "%rax",
         .returned = &returned,
         .label_mangle_index = &mangle_index,
@@ -246,22 +987,161 @@ void generate_function(symbol_t *function) {
     if (!returned) {
         puts("\t# Automatically generated return statement");
         puts("\tmovq $0, %rax");
-        puts("\tleave");
-        puts("\tret");
+        store_promoted_globals();
+        generate_epilogue();
     }
+
+    n_promoted_globals = 0;
 }
 
 static void write_param_accessor(size_t param, char *str, size_t nchars) {
     memset(str, 0, nchars);  // Reset buffer
 
-    if (param < 6) {
-        strcpy(str, PARAMETER_REGISTERS[param]);
+    if (param < convention->n_registers) {
+        strcpy(str, convention->registers[param]);
         return;
     }
 
-    snprintf(str, nchars, "%lu(%%rsp)", (param - 6) * 8);
+    snprintf(str, nchars, "%lu(%%rsp)", (param - convention->n_registers) * 8);
+}
+
+// A move of an argument into its location in the calling convention
+struct move_t {
+    char source[64];
+    char destination[64];
+};
+
+static bool is_register(const char *operand) {
+    return operand[0] == '%';
 }
 
+static bool is_memory(const char *operand) {
+    return !is_register(operand) && operand[0] != '$';
+}
+
+/**Checks if an operand can only be moved to memory through a register,
+ * i.e. memory itself or an immediate that doesn't fit in 32 bits */
+static bool needs_register(const char *operand) {
+    if (operand[0] != '$') {
+        return !is_register(operand);
+    }
+
+    int64_t value = strtol(operand + 1, NULL, 10);
+    return value < INT32_MIN || value > INT32_MAX;
+}
+
+static void emit_move(const char *source, const char *destination, const char *scratch) {
+    if (is_memory(destination) && needs_register(source)) {
+        printf("\tmovq %s, %s\n", source, scratch);
+        source = scratch;
+    }
+
+    printf("\tmovq %s, %s\n", source, destination);
+}
+
+/**Performs a set of moves as if they all happened at once, i.e. every source
+ * is read before any destination is written. Moves are ordered so that no
+ * source is overwritten before it is read, and only cycles of moves cost an
+ * extra move through a scratch register
+ * @param moves the moves to perform, consumed in the process
+ * @param movec the number of moves
+ * @param cycle_scratch register used to break cycles
+ * @param memory_scratch register used for moves between memory operands */
+static void resolve_parallel_moves(struct move_t *moves, size_t movec, const char *cycle_scratch,
+                                   const char *memory_scratch) {
+    size_t pending = movec;
+    bool done[movec];
+    for (size_t i = 0; i < movec; i++) {
+        done[i] = !strcmp(moves[i].source, moves[i].destination);
+        pending -= done[i];
+    }
+
+    while (pending > 0) {
+        bool progress = false;
+
+        for (size_t i = 0; i < movec; i++) {
+            if (done[i]) {
+                continue;
+            }
+
+            // The move is safe if no other pending move still reads its destination
+            bool blocked = false;
+            for (size_t j = 0; j < movec && !blocked; j++) {
+                blocked = j != i && !done[j] && !strcmp(moves[j].source, moves[i].destination);
+            }
+
+            if (!blocked) {
+                emit_move(moves[i].source, moves[i].destination, memory_scratch);
+                done[i] = true;
+                pending--;
+                progress = true;
+            }
+        }
+
+        if (progress) {
+            continue;
+        }
+
+        // Only cycles are left. Save the destination of one of the moves in
+        // the scratch register and let the moves reading it use that instead,
+        // which breaks the cycle
+        size_t i = 0;
+        while (done[i]) {
+            i++;
+        }
+
+        emit_move(moves[i].destination, cycle_scratch, memory_scratch);
+        for (size_t j = 0; j < movec; j++) {
+            if (!done[j] && !strcmp(moves[j].source, moves[i].destination)) {
+                strcpy(moves[j].source, cycle_scratch);
+            }
+        }
+    }
+}
+
+static bool contains_call(node_t *node) {
+    if (node == NULL) {
+        return false;
+    }
+
+    if (is_call(node)) {
+        return true;
+    }
+
+    for (size_t i = 0; i < node->n_children; i++) {
+        if (contains_call(node->children[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool contains_multiplication(node_t *node) {
+    if (node == NULL) {
+        return false;
+    }
+
+    if (node->type == EXPRESSION && node->data != NULL && node->n_children == 2 &&
+        (*((char *)node->data) == '*' || *((char *)node->data) == '/')) {
+        return true;
+    }
+
+    for (size_t i = 0; i < node->n_children; i++) {
+        if (contains_multiplication(node->children[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**Checks if generating an argument may overwrite an argument register. Calls
+ * clobber all of them, and multiplication and division use %rdx */
+static bool clobbers_register(node_t *node, const char *reg) {
+    return contains_call(node) || (!strcmp(reg, "%rdx") && contains_multiplication(node));
+}
+
+static void write_variable_accessor(char *buf, size_t bufsize, symbol_t *sym, symbol_t *function);
+
 static void call_function(struct compilation_target_t target) {
     if (target.node->n_children != 2) {
         fprintf(stderr, "Invalid function call\n");
@@ -282,33 +1162,86 @@ static void call_function(struct compilation_target_t target) {
     /*
     This compiler does not utilize the caller-saved registers in a way
     that requires us to save them here, that is to say that any value
-    that isn't immediately used is pushed to the stack anyway (this mainly
+    that isn't immediately used is stored in a temporary anyway (this mainly
     applies to expressions)
     */
 
-    unsigned int required_stack_space = MAX(6, func->nparms) - 6;
-    unsigned int alignment = allocate_aligned_stack(required_stack_space, target.stack_alignment);
+    // Arguments are evaluated in order, but only moved into place once all of
+    // them are done, since a later argument may contain calls that overwrite
+    // both the argument registers and the outgoing argument area. Constants
+    // and variables are moved straight from where they are
+    struct move_t moves[func->nparms];
+    size_t movec = 0;
 
-    char access_buffer[32] = {0};
+    // The index of the last argument that has to be computed, which can
+    // stay in %rax since nothing is evaluated after it
+    size_t last_computed = func->nparms;
+    for (size_t param = 0; param < func->nparms; param++) {
+        node_t *arg = argument_list->children[param];
+        if (arg->type != NUMBER_DATA && arg->type != IDENTIFIER_DATA) {
+            last_computed = param;
+        }
+    }
+
+    char destination[32];
     node_t *arg;
     for (size_t param = 0; param < func->nparms; param++) {
         arg = argument_list->children[param];
+        write_param_accessor(param, destination, 32);
+
+        bool later_clobbers = false, later_calls = false;
+        for (size_t later = param + 1; later < func->nparms; later++) {
+            later_clobbers |= clobbers_register(argument_list->children[later], destination);
+            later_calls |= contains_call(argument_list->children[later]);
+        }
+
+        struct move_t *move = &moves[movec];
+        strcpy(move->destination, destination);
+
+        // Locals and parameters can't be changed by a call, but globals
+        // have to be read before any later argument calls a function
+        if (arg->type == NUMBER_DATA) {
+            snprintf(move->source, 64, "$%ld", *((int64_t *)arg->data));
+            movec++;
+            continue;
+        }
+
+        if (arg->type == IDENTIFIER_DATA && (((symbol_t *)arg->entry)->type != SYM_GLOBAL_VAR || !later_calls)) {
+            write_variable_accessor(move->source, 64, arg->entry, target.function);
+            movec++;
+            continue;
+        }
 
-        write_param_accessor(param, access_buffer, 32);
+        // Every argument gets its own temporary, so the ones computed
+        // earlier are kept safe while this one is evaluated
         struct compilation_target_t child_target = {
             .function = target.function,
             .node = arg,
-            .stack_alignment = target.stack_alignment,
+            .temporary = target.temporary + param,
             .returned = NULL,
-            .target_destination = access_buffer,
+            .target_destination = "%rax",
             .label_mangle_index = target.label_mangle_index,
             .surrounding_loop_label = target.surrounding_loop_label};
 
         generate_node(child_target);
+
+        if (param < convention->n_registers && !later_clobbers) {
+            // Nothing evaluated after this overwrites the register, and the
+            // pending moves only read memory, so it can go right into place
+            printf("\tmovq %%rax, %s\n", destination);
+        } else if (param == last_computed) {
+            strcpy(move->source, "%rax");
+            movec++;
+        } else {
+            int slot = get_temporary_slot(target.function, target.temporary + param);
+            move_reg_to_slot("%rax", slot);
+            write_slot_accessor(move->source, 64, slot);
+            movec++;
+        }
     }
 
-    printf("\tcall %s%s\n", FUNC_PREFIX, func->name);
-    unalign_stack(alignment, target.stack_alignment);
+    resolve_parallel_moves(moves, movec, "%r10", "%r11");
+    printf("\tcall %s%s\n", convention->prefix, func->name);
 }
 
 static void generate_expression(struct compilation_target_t target) {
@@ -362,21 +1295,21 @@ static void generate_expression(struct compilation_target_t target) {
     struct compilation_target_t child_target = {
         .node = c2,
         .function = target.function,
-        .stack_alignment = target.stack_alignment,
+        .temporary = target.temporary,
         .returned = NULL,
         .target_destination = "%rax",
         .label_mangle_index = target.label_mangle_index,
         .surrounding_loop_label = target.surrounding_loop_label};
 
     generate_node(child_target);
-    *target.stack_alignment += 8;
-    puts("\tpushq %rax");  // Store temporary value
+    int slot = get_temporary_slot(target.function, target.temporary);
+    move_reg_to_slot("%rax", slot);  // Store temporary value
 
     child_target.node = c1;
+    child_target.temporary = target.temporary + 1;
 
     generate_node(child_target);
-    *target.stack_alignment -= 8;
-    puts("\tpopq %r10");  // Retrieve previously calculated value
+    move_slot_to_reg("%r10", slot);  // Retrieve previously calculated value
 
     // Now have lh side in rax and rh side in r8
 
@@ -424,28 +1357,34 @@ static void generate_conditional(struct compilation_target_t target) {
     struct compilation_target_t child_target = {
         .function = target.function,
         .returned = NULL,
-        .stack_alignment = target.stack_alignment,
+        .temporary = target.temporary,
         .target_destination = "%rax",
         .label_mangle_index = target.label_mangle_index,
         .surrounding_loop_label = target.surrounding_loop_label};
 
     child_target.node = lh_expr;
     generate_node(child_target);
-    *target.stack_alignment += 8;
-    puts("\tpushq %rax");
+    int slot = get_temporary_slot(target.function, target.temporary);
+    move_reg_to_slot("%rax", slot);
 
     child_target.target_destination = "%r11";
     child_target.node = rh_expr;
+    child_target.temporary = target.temporary + 1;
     generate_node(child_target);
-    *target.stack_alignment -= 8;
-    puts("\tpopq %r10");
+    move_slot_to_reg("%r10", slot);
     puts("\tcmpq %r11, %r10");
 }
 
 static void access_variable(const char *reg, symbol_t *sym, symbol_t *function) {
+    const char *promoted_register;
     switch (sym->type) {
         case SYM_GLOBAL_VAR:
-            move_global_to_reg(reg, sym->name);
+            promoted_register = get_promoted_register(sym);
+            if (promoted_register != NULL) {
+                printf("\tmovq %s, %s\n", promoted_register, reg);
+            } else {
+                move_global_to_reg(reg, sym->name);
+            }
             break;
         case SYM_LOCAL_VAR:
         case SYM_PARAMETER:
@@ -458,9 +1397,15 @@ static void access_variable(const char *reg, symbol_t *sym, symbol_t *function)
 }
 
 static void write_variable(const char *reg, symbol_t *sym, symbol_t *function) {
+    const char *promoted_register;
     switch (sym->type) {
         case SYM_GLOBAL_VAR:
-            move_reg_to_global(reg, sym->name);
+            promoted_register = get_promoted_register(sym);
+            if (promoted_register != NULL) {
+                printf("\tmovq %s, %s\n", reg, promoted_register);
+            } else {
+                move_reg_to_global(reg, sym->name);
+            }
             break;
         case SYM_LOCAL_VAR:
         case SYM_PARAMETER:
@@ -475,11 +1420,15 @@ static void write_variable(const char *reg, symbol_t *sym, symbol_t *function) {
 static void write_variable_accessor(char *buf, size_t bufsize, symbol_t *sym, symbol_t *function) {
     switch (sym->type) {
         case SYM_GLOBAL_VAR:
-            snprintf(buf, bufsize, ".%s", sym->name);
+            if (get_promoted_register(sym) != NULL) {
+                snprintf(buf, bufsize, "%s", get_promoted_register(sym));
+            } else {
+                snprintf(buf, bufsize, ".%s", sym->name);
+            }
             break;
         case SYM_LOCAL_VAR:
         case SYM_PARAMETER:
-            snprintf(buf, bufsize, "%d(%%rbp)", (get_slot(function, sym) + 1) * -8);
+            write_slot_accessor(buf, bufsize, get_slot(function, sym));
             break;
         default:
             fprintf(stderr, "Unsupported symbol type for identifier data \"%s\"\n", sym->name);
@@ -487,26 +1436,133 @@ static void write_variable_accessor(char *buf, size_t bufsize, symbol_t *sym, sy
     }
 }
 
-static void skip_jump_by_relation(char relation, char *label) {
-    switch (relation) {
-        case '=':
-            printf("\tjne %s\n", label);
-            break;
-        case '>':
-            printf("\tjng %s\n", label);
-            break;
-        case '<':
-            printf("\tjnl %s\n", label);
-            break;
-        default:
-            fprintf(stderr, "Unknown relation operator %c\n", relation);
-            break;
+static void skip_jump_by_relation(char relation, char *label) {
+    switch (relation) {
+        case '=':
+            printf("\tjne %s\n", label);
+            break;
+        case '>':
+            printf("\tjng %s\n", label);
+            break;
+        case '<':
+            printf("\tjnl %s\n", label);
+            break;
+        default:
+            fprintf(stderr, "Unknown relation operator %c\n", relation);
+            break;
+    }
+}
+
+static void jump_by_relation(char relation, char *label) {
+    switch (relation) {
+        case '=':
+            printf("\tje %s\n", label);
+            break;
+        case '>':
+            printf("\tjg %s\n", label);
+            break;
+        case '<':
+            printf("\tjl %s\n", label);
+            break;
+        default:
+            fprintf(stderr, "Unknown relation operator %c\n", relation);
+            break;
+    }
+}
+
+/**Checks if a statement always ends by returning from the function */
+static bool ends_in_return(node_t *node) {
+    switch (node->type) {
+        case RETURN_STATEMENT:
+            return true;
+        case IF_STATEMENT:
+            return node->n_children == 3 && ends_in_return(node->children[1]) &&
+                   ends_in_return(node->children[2]);
+        case BLOCK:
+        case STATEMENT_LIST:
+            return node->n_children > 0 && ends_in_return(node->children[node->n_children - 1]);
+        default:
+            return false;
+    }
+}
+
+static void conditional_move_by_relation(char relation, const char *source, const char *destination) {
+    switch (relation) {
+        case '=':
+            printf("\tcmove %s, %s\n", source, destination);
+            break;
+        case '>':
+            printf("\tcmovg %s, %s\n", source, destination);
+            break;
+        case '<':
+            printf("\tcmovl %s, %s\n", source, destination);
+            break;
+        default:
+            fprintf(stderr, "Unknown relation operator %c\n", relation);
+            break;
+    }
+}
+
+/**Generates an if-statement that picks which value to assign to a variable
+ * without branching. Values that are not variables or constants are computed
+ * into temporaries first, the rest are loaded after the compare since moves
+ * leave the flags alone
+ * @param target the if-statement
+ * @param move the parts of the if-statement, from find_conditional_move */
+static void generate_conditional_move(struct compilation_target_t target, struct conditional_move_t *move) {
+    struct compilation_target_t child_target = {
+        .function = target.function,
+        .returned = NULL,
+        .temporary = target.temporary,
+        .target_destination = "%rax",
+        .label_mangle_index = target.label_mangle_index,
+        .surrounding_loop_label = target.surrounding_loop_label};
+
+    int then_slot = -1, else_slot = -1;
+    if (!is_leaf(move->then_value)) {
+        child_target.node = move->then_value;
+        generate_node(child_target);
+        then_slot = get_temporary_slot(target.function, child_target.temporary++);
+        move_reg_to_slot("%rax", then_slot);
+    }
+    if (!is_leaf(move->else_value)) {
+        child_target.node = move->else_value;
+        generate_node(child_target);
+        else_slot = get_temporary_slot(target.function, child_target.temporary++);
+        move_reg_to_slot("%rax", else_slot);
+    }
+
+    child_target.node = move->relation;
+    generate_conditional(child_target);
+
+    if (else_slot < 0) {
+        child_target.node = move->else_value;
+        generate_node(child_target);
+    } else {
+        move_slot_to_reg("%rax", else_slot);
+    }
+
+    if (then_slot < 0) {
+        child_target.node = move->then_value;
+        child_target.target_destination = "%r10";
+        generate_node(child_target);
+    } else {
+        move_slot_to_reg("%r10", then_slot);
     }
+
+    conditional_move_by_relation(*((char *)move->relation->data), "%r10", "%rax");
+    write_variable("%rax", move->variable->entry, target.function);
 }
 
 static void generate_if_statement(struct compilation_target_t target) {
     node_t *relation;
 
+    struct conditional_move_t move;
+    if (find_conditional_move(target.node, &move)) {
+        generate_conditional_move(target, &move);
+        return;
+    }
+
     char first_skip_label[LABEL_MAX_SIZE] = {0};
     char control_end_buffer[LABEL_MAX_SIZE] = {0};
     bool local_return = false;
@@ -515,7 +1571,7 @@ static void generate_if_statement(struct compilation_target_t target) {
     struct compilation_target_t child_target = {
         .function = target.function,
         .returned = &local_return,
-        .stack_alignment = target.stack_alignment,
+        .temporary = target.temporary,
         .label_mangle_index = target.label_mangle_index,
         .surrounding_loop_label = target.surrounding_loop_label};
 
@@ -524,7 +1580,61 @@ static void generate_if_statement(struct compilation_target_t target) {
     generate_conditional(child_target);
 
     bool has_else = target.node->n_children == 3;
-    make_label(first_skip_label, LABEL_MAX_SIZE, has_else ? "ELSE" : "ENDIF", child_target);
+
+    // Inside a loop, a branch that returns from the function leaves the loop
+    // for good, so it runs at most once for all the iterations of the loop.
+    // Such branches are placed out of line, see generate_cold_branch
+    node_t *cold_branch = NULL;
+    if (target.surrounding_loop_label != NULL) {
+        if (ends_in_return(target.node->children[1])) {
+            cold_branch = target.node->children[1];
+        } else if (has_else && ends_in_return(target.node->children[2])) {
+            cold_branch = target.node->children[2];
+        }
+    }
+
+    make_label(first_skip_label, LABEL_MAX_SIZE, cold_branch != NULL ? "COLD" : has_else ? "ELSE" : "ENDIF",
+               child_target);
+    make_label(control_end_buffer, LABEL_MAX_SIZE, "ENDIF", child_target);
+
+    // Increase before generating the branches so that each control structure,
+    // including the ones nested inside this one, has its own "ID"
+    (*target.label_mangle_index)++;
+
+    if (cold_branch != NULL) {
+        node_t *hot_branch = NULL;
+        if (cold_branch == target.node->children[1]) {
+            jump_by_relation(*((char *)relation->data), first_skip_label);
+            hot_branch = has_else ? target.node->children[2] : NULL;
+        } else {
+            skip_jump_by_relation(*((char *)relation->data), first_skip_label);
+            hot_branch = target.node->children[1];
+        }
+
+        if (hot_branch != NULL) {
+            child_target.node = hot_branch;
+            generate_node(child_target);
+        }
+        return1 = local_return;
+
+        // The cold branch goes to its own section, away from the hot code
+        puts("\t.pushsection .text.unlikely");
+        label_here(first_skip_label);
+        local_return = false;
+        child_target.node = cold_branch;
+        generate_node(child_target);
+        if (!local_return) {
+            printf("\tjmp %s\n", control_end_buffer);
+        }
+        puts("\t.popsection");
+
+        if (return1 && local_return) {
+            *target.returned = true;
+        } else {
+            label_here(control_end_buffer);
+        }
+        return;
+    }
 
     skip_jump_by_relation(*((char *)relation->data), first_skip_label);
 
@@ -534,7 +1644,6 @@ static void generate_if_statement(struct compilation_target_t target) {
 
     if (has_else) {
         child_target.node = target.node->children[2];
-        make_label(control_end_buffer, LABEL_MAX_SIZE, "ENDIF", child_target);
 
         // This skips the jump instruction if the body of the if-statement
         // calls return, meaning we will never get to the jump instruction
@@ -546,6 +1655,7 @@ static void generate_if_statement(struct compilation_target_t target) {
     label_here(first_skip_label);
 
     if (has_else) {
+        local_return = false;
         generate_node(child_target);
 
         // This skips the last label of the block, and also marks the
@@ -558,42 +1668,342 @@ static void generate_if_statement(struct compilation_target_t target) {
             label_here(control_end_buffer);
         }
     }
+}
 
-    // Increase for next use so that each control structure has its own "ID"
-    (*target.label_mangle_index)++;
+/**Aligns the label that follows to the -falign-loops boundary */
+static void align_loop_head(void) {
+    if (loop_alignment > 1) {
+        int alignment_log2 = 0;
+        while ((2 << alignment_log2) <= loop_alignment) {
+            alignment_log2++;
+        }
+        printf("\t.p2align %d\n", alignment_log2);
+    }
+}
+
+/**Counts the nodes of a loop body that may be unrolled
+ * @param node the body
+ * @return the number of nodes, or -1 if the body contains a loop */
+static int unrolled_size(node_t *node) {
+    if (node == NULL) {
+        return 0;
+    }
+    if (node->type == WHILE_STATEMENT) {
+        return -1;
+    }
+
+    int size = 1;
+    for (size_t i = 0; i < node->n_children; i++) {
+        int child_size = unrolled_size(node->children[i]);
+        if (child_size < 0) {
+            return -1;
+        }
+        size += child_size;
+    }
+    return size;
+}
+
+/**Checks if a subtree assigns to a variable or contains a continue statement
+ * @param node the subtree
+ * @param sym the variable */
+static bool assigns_or_continues(node_t *node, symbol_t *sym) {
+    if (node == NULL) {
+        return false;
+    }
+
+    switch (node->type) {
+        case NULL_STATEMENT:
+            return true;
+        case ASSIGNMENT_STATEMENT:
+        case ADD_STATEMENT:
+        case SUBTRACT_STATEMENT:
+        case MULTIPLY_STATEMENT:
+        case DIVIDE_STATEMENT:
+            if (node->children[0]->entry == sym) {
+                return true;
+            }
+            break;
+        default:
+            break;
+    }
+
+    for (size_t i = 0; i < node->n_children; i++) {
+        if (assigns_or_continues(node->children[i], sym)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**Finds the constant a statement adds to a variable, if it is of the form
+ * i += c, i -= c, i := i + c or i := c + i
+ * @param node the statement
+ * @param sym the variable
+ * @param step set to the constant
+ * @return if the statement has one of the forms */
+static bool find_step(node_t *node, symbol_t *sym, int64_t *step) {
+    if (node->n_children != 2 || node->children[0]->entry != sym) {
+        return false;
+    }
+
+    node_t *value = node->children[1];
+    if ((node->type == ADD_STATEMENT || node->type == SUBTRACT_STATEMENT) && value->type == NUMBER_DATA) {
+        *step = *((int64_t *)value->data);
+        if (node->type == SUBTRACT_STATEMENT) {
+            *step = -*step;
+        }
+        return true;
+    }
+
+    if (node->type != ASSIGNMENT_STATEMENT || value->type != EXPRESSION || value->data == NULL ||
+        value->n_children != 2) {
+        return false;
+    }
+
+    char op = *((char *)value->data);
+    node_t *left = value->children[0], *right = value->children[1];
+    if (op == '+' && left->type == IDENTIFIER_DATA && left->entry == sym && right->type == NUMBER_DATA) {
+        *step = *((int64_t *)right->data);
+        return true;
+    }
+    if (op == '+' && right->type == IDENTIFIER_DATA && right->entry == sym && left->type == NUMBER_DATA) {
+        *step = *((int64_t *)left->data);
+        return true;
+    }
+    if (op == '-' && left->type == IDENTIFIER_DATA && left->entry == sym && right->type == NUMBER_DATA) {
+        *step = -*((int64_t *)right->data);
+        return true;
+    }
+    return false;
+}
+
+// A loop whose trip count can be computed when it is entered: a local
+// variable stepped by a constant at the end of the body and compared
+// against a bound that the body leaves alone
+struct counted_loop_t {
+    symbol_t *counter;
+    // The bound, a variable or a constant
+    node_t *bound;
+    int64_t step;
+    // The relation with the counter on the left hand side
+    char relation;
+};
+
+static bool is_local(node_t *node) {
+    return node->type == IDENTIFIER_DATA &&
+           (node->entry->type == SYM_LOCAL_VAR || node->entry->type == SYM_PARAMETER);
+}
+
+/**Checks if a while loop is counted, see counted_loop_t
+ * @param node the while statement
+ * @param loop set to the parts of the loop
+ * @return if the loop is counted */
+static bool find_counted_loop(node_t *node, struct counted_loop_t *loop) {
+    node_t *relation = node->children[0];
+    node_t *body = node->children[1];
+    char relation_type = *((char *)relation->data);
+    if (relation_type == '=') {
+        return false;
+    }
+
+    // Put the counter on the left hand side
+    node_t *counter = relation->children[0], *bound = relation->children[1];
+    if (!is_local(counter)) {
+        counter = relation->children[1];
+        bound = relation->children[0];
+        relation_type = relation_type == '<' ? '>' : '<';
+    }
+    if (!is_local(counter) || !(is_local(bound) || bound->type == NUMBER_DATA) ||
+        counter->entry == bound->entry) {
+        return false;
+    }
+
+    // The step is the last statement of the body, and the only statement
+    // that changes the counter
+    node_t *step = body;
+    while (step->type == STATEMENT_LIST || step->type == BLOCK) {
+        if (step->n_children == 0) {
+            return false;
+        }
+        for (size_t i = 0; i < step->n_children - 1; i++) {
+            if (assigns_or_continues(step->children[i], counter->entry)) {
+                return false;
+            }
+        }
+        step = step->children[step->n_children - 1];
+    }
+    if (!find_step(step, counter->entry, &loop->step)) {
+        return false;
+    }
+    if (bound->type == IDENTIFIER_DATA && assigns_or_continues(body, bound->entry)) {
+        return false;
+    }
+
+    // The counter has to move towards the bound, by little enough that the
+    // distance covered by the unrolled copies fits in an immediate
+    if (relation_type == '<' ? loop->step <= 0 : loop->step >= 0) {
+        return false;
+    }
+    int64_t distance = loop->step < 0 ? -loop->step : loop->step;
+    if (distance > INT32_MAX / (unroll_factor - 1)) {
+        return false;
+    }
+
+    loop->counter = counter->entry;
+    loop->bound = bound;
+    loop->relation = relation_type;
+    return true;
+}
+
+/**Generates the test of whether all the unrolled copies of the body of a
+ * counted loop can run, i.e. if the counter still passes the test of the
+ * loop after the steps of all but the last copy
+ * @param target the while statement
+ * @param loop the parts of the loop
+ * @param pass_label where to jump to if the test passes, or NULL to fall
+ *        through in that case
+ * @param fail_label where to jump to if the test fails, which includes
+ *        overflow while stepping the counter */
+static void generate_unrolled_test(struct compilation_target_t target, struct counted_loop_t *loop,
+                                   char *pass_label, char *fail_label) {
+    access_variable("%rax", loop->counter, target.function);
+    printf("\taddq $%ld, %%rax\n", loop->step * (unroll_factor - 1));
+    printf("\tjo %s\n", fail_label);
+    if (loop->bound->type == NUMBER_DATA) {
+        printf("\tmovq $%ld, %%r11\n", *((int64_t *)loop->bound->data));
+    } else {
+        access_variable("%r11", loop->bound->entry, target.function);
+    }
+    puts("\tcmpq %r11, %rax");
+    if (pass_label == NULL) {
+        skip_jump_by_relation(loop->relation, fail_label);
+    } else {
+        jump_by_relation(loop->relation, pass_label);
+    }
+}
+
+/**Generates copies of the body of a loop. A continue statement jumps to the
+ * end of its copy, where the test of the loop is if end_label is set, and
+ * then goes on to the next copy
+ * @param target the while statement
+ * @param child_target target of the body
+ * @param copies the number of copies
+ * @param end_label label to jump to when the test after a copy fails, or
+ *        NULL to run the copies without tests */
+static void generate_unrolled_body(struct compilation_target_t target, struct compilation_target_t child_target,
+                                   int copies, char *end_label) {
+    node_t *relation = target.node->children[0];
+    char relation_type = *((char *)relation->data);
+    char copy_end_label[LABEL_MAX_SIZE] = {0};
+
+    for (int copy = 0; copy < copies; copy++) {
+        make_label(copy_end_label, LABEL_MAX_SIZE, "WCOPY", child_target);
+        (*target.label_mangle_index)++;
+
+        child_target.surrounding_loop_label = copy_end_label;
+        child_target.node = target.node->children[1];
+        generate_node(child_target);
+
+        label_here(copy_end_label);
+        if (end_label != NULL) {
+            child_target.node = relation;
+            generate_conditional(child_target);
+            skip_jump_by_relation(relation_type, end_label);
+        }
+    }
 }
 
+/**Generates a while loop rotated into a do-while loop behind a guard, i.e.
+ * the condition is tested once in front of the loop and then at the bottom
+ * of the body, so that each iteration only takes one conditional branch.
+ *
+ * Loops with small bodies are unrolled, see -funroll-loops. If the trip
+ * count of the loop is known when it is entered, see find_counted_loop, the
+ * unrolled copies run without tests between them for as long as all of them
+ * can, and a loop with a single copy runs the remaining iterations.
+ * Otherwise the test is done after each copy */
 static void generate_while_statement(struct compilation_target_t target) {
+    char body_label[LABEL_MAX_SIZE] = {0};
     char check_label[LABEL_MAX_SIZE] = {0};
     char end_label[LABEL_MAX_SIZE] = {0};
+    char unrolled_label[LABEL_MAX_SIZE] = {0};
+    char remainder_label[LABEL_MAX_SIZE] = {0};
     bool local_return = false;
 
     struct compilation_target_t child_target = {
         .function = target.function,
         .returned = &local_return,
-        .stack_alignment = target.stack_alignment,
+        .temporary = target.temporary,
         .label_mangle_index = target.label_mangle_index,
         .surrounding_loop_label = target.surrounding_loop_label};
 
+    make_label(body_label, LABEL_MAX_SIZE, "WBODY", child_target);
     make_label(check_label, LABEL_MAX_SIZE, "WCHECK", child_target);
     make_label(end_label, LABEL_MAX_SIZE, "WEND", child_target);
-    label_here(check_label);
+    make_label(unrolled_label, LABEL_MAX_SIZE, "WUNROLLED", child_target);
+    make_label(remainder_label, LABEL_MAX_SIZE, "WREMAINDER", child_target);
+
+    // Increase before generating the body so that each control structure,
+    // including the ones nested inside this one, has its own "ID"
+    (*target.label_mangle_index)++;
 
     node_t *relation = target.node->children[0];
     node_t *body = target.node->children[1];
+    char relation_type = *((char *)relation->data);
+
+    int copies = 1;
+    struct counted_loop_t counted;
+    bool is_counted = false;
+    if (unroll_loops && unroll_factor > 1) {
+        int size = unrolled_size(body);
+        if (size >= 0 && size <= unroll_limit) {
+            copies = unroll_factor;
+            is_counted = find_counted_loop(target.node, &counted);
+        }
+    }
+
+    // Loops without calls keep the globals they use in registers, which
+    // are stored back after the loop and at returns from inside it
+    bool promoted = begin_global_promotion(target.node, 1);
+
+    if (is_counted) {
+        // The unrolled copies are skipped when there are too few iterations
+        // left for all of them
+        generate_unrolled_test(target, &counted, NULL, remainder_label);
+        align_loop_head();
+        label_here(unrolled_label);
+        generate_unrolled_body(target, child_target, copies, NULL);
+        generate_unrolled_test(target, &counted, unrolled_label, remainder_label);
+        label_here(remainder_label);
+        copies = 1;
+    }
 
+    // Guard, skips the loop entirely if it is never entered
     child_target.node = relation;
     generate_conditional(child_target);
-    skip_jump_by_relation(*((char *)relation->data), end_label);
+    skip_jump_by_relation(relation_type, end_label);
+
+    // Align the top of the loop, which is the target of the backward branch
+    align_loop_head();
+    label_here(body_label);
 
+    generate_unrolled_body(target, child_target, copies - 1, end_label);
+
+    // A continue statement jumps to the test at the bottom
     child_target.surrounding_loop_label = check_label;
     child_target.node = body;
     generate_node(child_target);
-    printf("\tjmp %s\n", check_label);
+
+    label_here(check_label);
+    child_target.node = relation;
+    generate_conditional(child_target);
+    jump_by_relation(relation_type, body_label);
     label_here(end_label);
 
-    // Increase for next use so that each control structure has its own "ID"
-    (*target.label_mangle_index)++;
+    if (promoted) {
+        store_promoted_globals();
+        n_promoted_globals = 0;
+    }
 }
 
 static void generate_assignment(struct compilation_target_t target) {
@@ -603,7 +2013,7 @@ static void generate_assignment(struct compilation_target_t target) {
     struct compilation_target_t child_target = {
         .function = target.function,
         .returned = target.returned,
-        .stack_alignment = target.stack_alignment,
+        .temporary = target.temporary,
         .label_mangle_index = target.label_mangle_index,
         .surrounding_loop_label = target.surrounding_loop_label};
 
@@ -651,51 +2061,90 @@ static void genereate_number_data(struct compilation_target_t target) {
     printf("\tmovq $%ld, %s\n", value, target.target_destination);
 }
 
+static size_t add_text(char *text) {
+    for (size_t i = 0; i < textc; i++) {
+        if (!strcmp(text_list[i], text)) {
+            free(text);
+            return i;
+        }
+    }
+
+    if (textc >= n_text_list) {
+        n_text_list = n_text_list == 0 ? 8 : n_text_list * 2;
+        text_list = realloc(text_list, n_text_list * sizeof(char *));
+    }
+
+    text_list[textc] = text;
+    return textc++;
+}
+
+/**Writes a piece of constant text to the output buffer
+ * @param text the text, owned by the text table from here on */
+static void generate_text_write(char *text) {
+    size_t index = add_text(text);
+    printf("\tmovq $.TXT%lu, %%rdi\n", index);
+    printf("\tmovq $(.TXT%lu_END-.TXT%lu), %%rsi\n", index, index);
+    puts("\tcall _vsl_write");
+}
+
+static void write_text(FILE **text_stream, char **text, size_t *text_size) {
+    fclose(*text_stream);
+
+    if (*text_size == 0) {
+        free(*text);
+    } else {
+        generate_text_write(*text);
+    }
+
+    *text_stream = open_memstream(text, text_size);
+}
+
 static void generate_print_statement(struct compilation_target_t target) {
     struct compilation_target_t child_target = {
         .function = target.function,
         .returned = target.returned,
-        .stack_alignment = target.stack_alignment,
+        .temporary = target.temporary,
+        .target_destination = "%rdi",
         .label_mangle_index = target.label_mangle_index,
         .surrounding_loop_label = target.surrounding_loop_label};
 
-    node_t *item;
-    unsigned int alignment;
+    // String literals and constant numbers are collected into one piece of
+    // text, which is written to the output buffer in front of the next value
+    // that has to be computed at run time
+    char *text;
+    size_t text_size;
+    FILE *text_stream = open_memstream(&text, &text_size);
 
+    node_t *item;
     for (size_t i = 0; i < target.node->n_children; i++) {
         item = target.node->children[i];
 
         switch (item->type) {
             case STRING_DATA:
-                printf("\tmovq $.strout, %%rdi\n");
-                printf("\tmovq $.STR%ld, %%rsi\n", *((size_t *)item->data));
+                // The literal is stored with its quotes
+                fprintf(text_stream, "%.*s ", (int)strlen(string_list[*((size_t *)item->data)]) - 2,
+                        string_list[*((size_t *)item->data)] + 1);
                 break;
-            case IDENTIFIER_DATA:
-                printf("\tmovq $.intout, %%rdi\n");
-                access_variable("%rsi", item->entry, target.function);
+            case NUMBER_DATA:
+                fprintf(text_stream, "%ld ", *((int64_t *)item->data));
                 break;
-            case EXPRESSION:
-                child_target.node = item;
-                child_target.target_destination = "%rsi";
+            default:
+                // Everything in front of the item is written before it is
+                // evaluated, since it may contain calls that print as well
+                write_text(&text_stream, &text, &text_size);
 
+                child_target.node = item;
                 generate_node(child_target);
-                printf("\tmovq $.intout, %%rdi\n");
+
+                puts("\tcall _vsl_write_int");
                 break;
         }
-
-        // We align at every print call because expressions etc.
-        // may push variables on the stack, causing an alignment
-        // for this as a whole to not work real well
-        alignment = align_stack(target.stack_alignment);
-        puts("\tcall printf");
-        unalign_stack(alignment, target.stack_alignment);
     }
 
-    // New line
-    printf("\tmovq $.newline, %%rdi\n");
-    alignment = align_stack(target.stack_alignment);
-    puts("\tcall printf");
-    unalign_stack(alignment, target.stack_alignment);
+    fputs("\\n", text_stream);
+    write_text(&text_stream, &text, &text_size);
+    fclose(text_stream);
+    free(text);
 }
 
 static void generate_return_statement(struct compilation_target_t target) {
@@ -709,15 +2158,15 @@ static void generate_return_statement(struct compilation_target_t target) {
     struct compilation_target_t child_target = {
         .function = target.function,
         .returned = target.returned,
-        .stack_alignment = target.stack_alignment,
+        .temporary = target.temporary,
         .label_mangle_index = target.label_mangle_index,
         .surrounding_loop_label = target.surrounding_loop_label,
         .node = target.node->children[0],
         .target_destination = "%rax"};
 
     generate_node(child_target);
-    puts("\tleave");
-    puts("\tret");
+    store_promoted_globals();
+    generate_epilogue();
 }
 
 void generate_node(struct compilation_target_t target) {
@@ -770,7 +2219,7 @@ void generate_node(struct compilation_target_t target) {
     struct compilation_target_t child_target = {
         .function = target.function,
         .returned = target.returned,
-        .stack_alignment = target.stack_alignment,
+        .temporary = target.temporary,
         .label_mangle_index = target.label_mangle_index,
         .surrounding_loop_label = target.surrounding_loop_label};
 
@@ -788,6 +2237,272 @@ void generate_node(struct compilation_target_t target) {
     }
 }
 
+static int get_value_slot(symbol_t *function, ssa_instruction_t *value) {
+    return MIN(convention->n_registers, function->nparms) + value->id;
+}
+
+/**Writes the operand holding an SSA value. Constants are immediates and
+ * parameters stay in their slots, every other value has a slot of its own
+ * @param buf buffer to write the operand to
+ * @param bufsize size of the buffer
+ * @param value the instruction computing the value
+ * @param function symbol table entry of the function */
+static void write_value_accessor(char *buf, size_t bufsize, ssa_instruction_t *value, symbol_t *function) {
+    switch (value->opcode) {
+        case SSA_CONSTANT:
+            snprintf(buf, bufsize, "$%ld", value->constant);
+            break;
+        case SSA_PARAMETER:
+            write_slot_accessor(buf, bufsize, get_slot(function, value->symbol));
+            break;
+        default:
+            write_slot_accessor(buf, bufsize, get_value_slot(function, value));
+            break;
+    }
+}
+
+static void load_value(const char *reg, ssa_instruction_t *value, symbol_t *function) {
+    char accessor[64];
+    write_value_accessor(accessor, 64, value, function);
+    printf("\tmovq %s, %s\n", accessor, reg);
+}
+
+static void write_block_label(char *buf, size_t bufsize, ssa_block_t *block, symbol_t *function) {
+    snprintf(buf, bufsize, "._%s_B%lu", function->name, block->id);
+}
+
+/**Jumps from a block to its only successor, giving the phis of the
+ * successor the values that flow in along the edge
+ * @param block the block that jumps
+ * @param function symbol table entry of the function */
+static void generate_ssa_jump(ssa_block_t *block, symbol_t *function) {
+    ssa_block_t *successor = block->successors[0];
+
+    size_t edge = 0;
+    while (successor->predecessors[edge] != block) {
+        edge++;
+    }
+
+    // The phis all take their values at once, and may read each other
+    struct move_t moves[successor->n_instructions + 1];
+    size_t movec = 0;
+    for (size_t i = 0; i < successor->n_instructions; i++) {
+        ssa_instruction_t *phi = successor->instructions[i];
+        if (phi->opcode != SSA_PHI) {
+            break;
+        }
+
+        write_value_accessor(moves[movec].source, 64, phi->operands[edge], function);
+        write_value_accessor(moves[movec].destination, 64, phi, function);
+        movec++;
+    }
+    resolve_parallel_moves(moves, movec, "%r10", "%r11");
+
+    char label[LABEL_MAX_SIZE];
+    write_block_label(label, LABEL_MAX_SIZE, successor, function);
+    printf("\tjmp %s\n", label);
+}
+
+static void generate_ssa_call(ssa_instruction_t *call, symbol_t *function) {
+    // The arguments are already computed, so they can all be moved into
+    // place at once
+    struct move_t moves[call->n_operands + 1];
+    for (size_t param = 0; param < call->n_operands; param++) {
+        write_value_accessor(moves[param].source, 64, call->operands[param], function);
+        write_param_accessor(param, moves[param].destination, 64);
+    }
+    resolve_parallel_moves(moves, call->n_operands, "%r10", "%r11");
+    printf("\tcall %s%s\n", convention->prefix, call->symbol->name);
+}
+
+static void generate_ssa_instruction(ssa_instruction_t *instruction, symbol_t *function) {
+    char label[LABEL_MAX_SIZE];
+    ssa_block_t *block = instruction->block;
+
+    switch (instruction->opcode) {
+        case SSA_CONSTANT:
+        case SSA_PARAMETER:
+        case SSA_PHI:
+            // Constants are used as immediates, parameters are already in
+            // their slots, and phis are written by the jumps to their block
+            return;
+        case SSA_LOAD_GLOBAL:
+            move_global_to_reg("%rax", instruction->symbol->name);
+            break;
+        case SSA_STORE_GLOBAL:
+            load_value("%rax", instruction->operands[0], function);
+            move_reg_to_global("%rax", instruction->symbol->name);
+            return;
+        case SSA_UNARY:
+            load_value("%rax", instruction->operands[0], function);
+            printf(instruction->op == '-' ? "\tnegq %%rax\n" : "\tnotq %%rax\n");
+            break;
+        case SSA_BINARY:
+            if (instruction->op == '>') {
+                load_value("%rax", instruction->operands[0], function);
+                printf("\tshrq $%ld, %%rax\n", instruction->operands[1]->constant);
+                break;
+            }
+
+            load_value("%r10", instruction->operands[1], function);
+            load_value("%rax", instruction->operands[0], function);
+            switch (instruction->op) {
+                case '|':
+                    puts("\torq %r10, %rax");
+                    break;
+                case '^':
+                    puts("\txorq %r10, %rax");
+                    break;
+                case '&':
+                    puts("\tandq %r10, %rax");
+                    break;
+                case '+':
+                    puts("\taddq %r10, %rax");
+                    break;
+                case '-':
+                    puts("\tsubq %r10, %rax");
+                    break;
+                case '*':
+                    puts("\timulq %r10");
+                    break;
+                case '/':
+                    if (instruction->narrow) {
+                        puts("\txorl %edx, %edx");
+                        // divl writes the quotient to %eax, which clears the
+                        // upper half of %rax. The quotient of non-negative
+                        // 32-bit values is therefore already zero-extended
+                        puts("\tdivl %r10d");
+                    } else {
+                        puts("\tcqto");
+                        puts("\tidivq %r10");
+                    }
+                    break;
+            }
+            break;
+        case SSA_CALL:
+            generate_ssa_call(instruction, function);
+            break;
+        case SSA_PRINT_TEXT:
+            generate_text_write(strdup(instruction->text));
+            return;
+        case SSA_PRINT_VALUE:
+            load_value("%rdi", instruction->operands[0], function);
+            puts("\tcall _vsl_write_int");
+            return;
+        case SSA_JUMP:
+            generate_ssa_jump(block, function);
+            return;
+        case SSA_BRANCH:
+            load_value("%r10", instruction->operands[1], function);
+            load_value("%rax", instruction->operands[0], function);
+            puts("\tcmpq %r10, %rax");
+            write_block_label(label, LABEL_MAX_SIZE, block->successors[0], function);
+            jump_by_relation(instruction->op, label);
+            write_block_label(label, LABEL_MAX_SIZE, block->successors[1], function);
+            printf("\tjmp %s\n", label);
+            return;
+        case SSA_RETURN:
+            load_value("%rax", instruction->operands[0], function);
+            generate_epilogue();
+            return;
+    }
+
+    move_reg_to_slot("%rax", get_value_slot(function, instruction));
+}
+
+void generate_ssa_function(symbol_t *function) {
+    ssa_function_t *ssa = build_ssa_function(function);
+    optimize_ssa_function(ssa);
+
+    // Values moved into phis at the end of a block that branches would
+    // also be moved on the other path, so such edges get a block of their
+    // own to hold the moves
+    split_critical_edges(ssa);
+
+    // Every value gets a slot, with the arguments of calls at the bottom
+    size_t outgoing_arguments = 0;
+    bool calls = false;
+    for (size_t b = 0; b < ssa->n_blocks; b++) {
+        ssa_block_t *block = ssa->blocks[b];
+        for (size_t i = 0; i < block->n_instructions; i++) {
+            ssa_instruction_t *instruction = block->instructions[i];
+            switch (instruction->opcode) {
+                case SSA_CALL:
+                    outgoing_arguments = MAX(outgoing_arguments,
+                                             MAX(convention->n_registers, instruction->n_operands) -
+                                                 convention->n_registers);
+                    calls = true;
+                    break;
+                case SSA_PRINT_TEXT:
+                case SSA_PRINT_VALUE:
+                    calls = true;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    size_t slots = MIN(convention->n_registers, function->nparms) + ssa->n_values + outgoing_arguments;
+    generate_prologue(function, slots, calls);
+
+    char label[LABEL_MAX_SIZE];
+    for (size_t b = 0; b < ssa->n_blocks; b++) {
+        ssa_block_t *block = ssa->blocks[b];
+        if (block->is_loop_header) {
+            align_loop_head();
+        }
+        write_block_label(label, LABEL_MAX_SIZE, block, function);
+        label_here(label);
+
+        for (size_t i = 0; i < block->n_instructions; i++) {
+            generate_ssa_instruction(block->instructions[i], function);
+        }
+    }
+
+    destroy_ssa_function(ssa);
+}
+
+void generate_abi_wrapper(symbol_t *function) {
+    size_t n_registers = convention->n_registers;
+
+    puts(".section .text");
+    printf(".globl %s%s\n", FUNC_PREFIX, function->name);
+    printf("%s%s:\n", FUNC_PREFIX, function->name);
+
+    // The private convention passes arguments in registers System V
+    // expects to be preserved
+    const char *preserved[] = {"%rbx", "%r12", "%r13", "%r14", "%r15"};
+    size_t n_preserved = sizeof(preserved) / sizeof(preserved[0]);
+    for (size_t i = 0; i < n_preserved; i++) {
+        printf("\tpushq %s\n", preserved[i]);
+    }
+
+    // Arguments from the seventh onwards are on the stack, above the
+    // return address and the registers we just saved
+    size_t stack_arguments = (n_preserved + 1) * 8;
+    for (size_t param = 6; param < MIN(n_registers, function->nparms); param++) {
+        printf("\tmovq %lu(%%rsp), %s\n", stack_arguments + (param - 6) * 8, convention->registers[param]);
+    }
+
+    // The ones that don't fit in registers are passed on again, each
+    // push moves the rest of them further up
+    size_t pushed = 0;
+    for (size_t param = function->nparms; param > n_registers; param--, pushed++) {
+        printf("\tpushq %lu(%%rsp)\n", stack_arguments + (param - 1 - 6 + pushed) * 8);
+    }
+
+    printf("\tcall %s%s\n", convention->prefix, function->name);
+    if (pushed != 0) {
+        printf("\taddq $%lu, %%rsp\n", pushed * 8);
+    }
+
+    for (size_t i = n_preserved; i > 0; i--) {
+        printf("\tpopq %s\n", preserved[i - 1]);
+    }
+    puts("\tret");
+}
+
 /**Generates the main function with argument parsing and calling of our
  * main function (first, if no function is named main)
  * @param first Symbol table entry of our main function */
@@ -799,52 +2514,212 @@ void generate_main(symbol_t *first) {
     puts("\tpushq   %rbp");
     puts("\tmovq    %rsp, %rbp");
 
-    unsigned int stack_alignment = 0;
+    size_t argc = first->nparms;
 
     printf("\tsubq\t$1,%%rdi\n");
-    printf("\tcmpq\t$%zu,%%rdi\n", first->nparms);
+    printf("\tcmpq\t$%zu,%%rdi\n", argc);
     printf("\tjne\tABORT\n");
-    printf("\tcmpq\t$0,%%rdi\n");
-    printf("\tjz\tSKIP_ARGS\n");
 
-    printf("\tmovq\t%%rdi,%%rcx\n");
-    printf("\taddq $%zu, %%rsi\n", 8 * first->nparms);
-    printf("PARSE_ARGV:\n");
-    printf("\tpushq %%rcx\n");
-    printf("\tpushq %%rsi\n");
+    if (argc > 0) {
+        // The arguments are parsed into a fixed area at the bottom of the
+        // frame, in order. Above them we keep argv and the loop counter,
+        // since strtol may clobber any caller-saved register
+        size_t argv_offset = argc * 8, counter_offset = (argc + 1) * 8;
+        printf("\tsubq\t$%zu,%%rsp\n", ((argc + 2) * 8 + 15) & ~15);
+        printf("\tmovq\t%%rsi,%zu(%%rsp)\n", argv_offset);
+        printf("\tmovq\t$%zu,%zu(%%rsp)\n", argc, counter_offset);
+
+        printf("PARSE_ARGV:\n");
+        printf("\tmovq\t%zu(%%rsp),%%rcx\n", counter_offset);
+        printf("\tmovq\t%zu(%%rsp),%%rsi\n", argv_offset);
+        printf("\tmovq\t(%%rsi,%%rcx,8),%%rdi\n");
+        printf("\tmovq\t$0,%%rsi\n");
+        printf("\tmovq\t$10,%%rdx\n");
+        printf("\tcall\tstrtol\n");
+
+        /*  Now a new argument is an integer in rax */
+
+        printf("\tmovq\t%zu(%%rsp),%%rcx\n", counter_offset);
+        printf("\tmovq\t%%rax,-8(%%rsp,%%rcx,8)\n");
+        printf("\tsubq\t$1,%%rcx\n");
+        printf("\tmovq\t%%rcx,%zu(%%rsp)\n", counter_offset);
+        printf("\tjnz\tPARSE_ARGV\n");
+
+        /* Now the arguments are in order on stack */
+        for (int arg = 0; arg < MIN(6, argc); arg++)
+            printf("\tmovq\t%d(%%rsp),%s\n", arg * 8, PARAMETER_REGISTERS[arg]);
+
+        // Leaves the seventh argument and onwards at the top of the stack,
+        // 48 bytes keeps the alignment
+        if (argc > 6)
+            printf("\taddq\t$48,%%rsp\n");
+    }
 
-    printf("\tmovq\t(%%rsi),%%rdi\n");
-    printf("\tmovq\t$0,%%rsi\n");
-    printf("\tmovq\t$10,%%rdx\n");
-    printf("\tcall\tstrtol\n");
+    printf("\tcall %s%s\n", FUNC_PREFIX, first->name);
 
-    /*  Now a new argument is an integer in rax */
+    printf("END:\n");
+    puts("\tpushq   %rax");
+    puts("\tcall    _vsl_flush");
+
+    // The counters of the tables of memoized functions go to stderr
+    if (memoize_stats && any_memoized) {
+        size_t n_globals = tlhash_size(global_names);
+        symbol_t *global_list[n_globals];
+        tlhash_values(global_names, (void **)global_list);
+        void *found;
+        for (size_t i = 0; i < n_globals; i++) {
+            symbol_t *sym = global_list[i];
+            if (tlhash_lookup(&memoized, &sym, sizeof(symbol_t *), &found) != TLHASH_SUCCESS) {
+                continue;
+            }
+            char *text;
+            size_t text_size;
+            FILE *text_stream = open_memstream(&text, &text_size);
+            fprintf(text_stream, "memo %s: hits ", sym->name);
+            fclose(text_stream);
+            generate_text_write(text);
+            printf("\tmovq _vsl_memo_%s_hits, %%rdi\n", sym->name);
+            puts("\tcall _vsl_write_int");
+            generate_text_write(strdup("misses "));
+            printf("\tmovq _vsl_memo_%s_misses, %%rdi\n", sym->name);
+            puts("\tcall _vsl_write_int");
+            generate_text_write(strdup("\\n"));
+        }
+        puts("\tmovq    $2, %rdi");
+        puts("\tcall    _vsl_flush_to");
+    }
 
-    printf("\tpopq %%rsi\n");
-    printf("\tpopq %%rcx\n");
-    printf("\tpushq %%rax\n");
+    puts("\tpopq    %rdi");
+    puts("\tcall    exit");
 
-    printf("\tsubq $8, %%rsi\n");
-    printf("\tloop PARSE_ARGV\n");
+    // Wrong number of arguments, only happens once if at all
+    puts("\t.pushsection .text.unlikely");
+    printf("ABORT:\n");
+    printf("\tmovq\t$.errout, %%rdi\n");
+    printf("\tcall puts\n");
+    printf("\tjmp\tEND\n");
+    puts("\t.popsection");
+}
 
-    /* Now the arguments are in order on stack */
-    for (int arg = 0; arg < MIN(6, first->nparms); arg++)
-        printf("\tpopq\t%s\n", PARAMETER_REGISTERS[arg]);
+/**Generates the buffered output routines used by print statements, so that
+ * generated programs don't go through stdio. All of them follow the normal
+ * calling convention, but don't require the stack to be aligned */
+void generate_runtime(void) {
+    puts(".section .bss");
+    puts(".align 8");
+    puts("_vsl_outpos: .zero 8");
+    printf("_vsl_outbuf: .zero %d\n", OUTPUT_BUFFER_SIZE);
 
-    stack_alignment += (MAX(6, first->nparms) - 6) * 8;
+    // Pairs of decimal digits for 00 to 99, so that integers are converted
+    // two digits per division
+    puts(".section .rodata");
+    printf("_vsl_digits:\n\t.ascii \"");
+    for (int i = 0; i < 100; i++) {
+        printf("%02d", i);
+    }
+    puts("\"");
 
-    printf("SKIP_ARGS:\n");
+    puts(".section .text");
 
-    unsigned int alignment = align_stack(&stack_alignment);
-    printf("\tcall %s%s\n", FUNC_PREFIX, first->name);
-    unalign_stack(alignment, &stack_alignment);
+    // Flushes the output buffer to stdout, or to the file descriptor in
+    // %rdi. Falls through to the loop that writes %rdx bytes from %rsi,
+    // which is also used for text that does not fit in the buffer at all
+    puts("_vsl_flush:");
+    puts("\tmovq $1, %rdi");
+    puts("_vsl_flush_to:");
+    puts("\tmovq $_vsl_outbuf, %rsi");
+    puts("\tmovq _vsl_outpos, %rdx");
+    puts("\tmovq $0, _vsl_outpos");
+    puts("_vsl_write_out:");
+    puts("\ttestq %rdx, %rdx");
+    puts("\tjz .Lvsl_write_out_done");
+    printf("\tmovq $%d, %%rax\n", SYS_WRITE);
+    puts("\tsyscall");
+    printf("\tcmpq $-%d, %%rax\n", EINTR);
+    puts("\tje _vsl_write_out");
+    // Nothing sensible to do about other errors, the output is dropped
+    puts("\ttestq %rax, %rax");
+    puts("\tjle .Lvsl_write_out_done");
+    puts("\taddq %rax, %rsi");
+    puts("\tsubq %rax, %rdx");
+    puts("\tjmp _vsl_write_out");
+    puts(".Lvsl_write_out_done:");
+    puts("\tret");
 
-    printf("\tjmp\tEND\n");
-    printf("ABORT:\n");
-    printf("\tmovq\t$.errout, %%rdi\n");
-    printf("\tcall puts\n");
+    // Appends %rsi bytes from %rdi to the output buffer
+    puts("_vsl_write:");
+    puts("\tmovq _vsl_outpos, %rax");
+    puts("\tleaq (%rax, %rsi), %rdx");
+    printf("\tcmpq $%d, %%rdx\n", OUTPUT_BUFFER_SIZE);
+    puts("\tjbe .Lvsl_write_copy");
+    puts("\tpushq %rdi");
+    puts("\tpushq %rsi");
+    puts("\tcall _vsl_flush");
+    puts("\tpopq %rdx");
+    puts("\tpopq %rsi");
+    printf("\tcmpq $%d, %%rdx\n", OUTPUT_BUFFER_SIZE);
+    puts("\tja _vsl_write_out");
+    puts("\tmovq %rdx, %rax");
+    puts("\tmovq %rsi, %rdi");
+    puts("\tmovq %rax, %rsi");
+    puts("\tmovq $0, %rax");
+    puts(".Lvsl_write_copy:");
+    puts("\tmovq %rsi, %rcx");
+    puts("\tmovq %rdi, %rsi");
+    puts("\tleaq _vsl_outbuf(%rax), %rdi");
+    puts("\taddq %rcx, %rax");
+    puts("\tmovq %rax, _vsl_outpos");
+    puts("\trep movsb");
+    puts("\tret");
 
-    printf("END:\n");
-    puts("\tmovq    %rax, %rdi");
-    puts("\tcall    exit");
+    // Appends the decimal value of %rdi followed by a space to the output
+    // buffer. The digits are built backwards in front of the space
+    puts("_vsl_write_int:");
+    puts("\tsubq $32, %rsp");
+    puts("\tmovb $32, 31(%rsp)");  // ' '
+    puts("\tleaq 31(%rsp), %rsi");
+    puts("\tmovq $0x28f5c28f5c28f5c3, %r8");
+    puts("\tmovq %rdi, %rax");
+    puts("\ttestq %rax, %rax");
+    puts("\tjns .Lvsl_write_int_pairs");
+    // The magnitude of the most negative value is still correct as unsigned
+    puts("\tnegq %rax");
+    puts(".Lvsl_write_int_pairs:");
+    puts("\tcmpq $100, %rax");
+    puts("\tjb .Lvsl_write_int_last");
+    // Unsigned division by 100 through multiplication with its reciprocal
+    puts("\tmovq %rax, %rcx");
+    puts("\tshrq $2, %rax");
+    puts("\tmulq %r8");
+    puts("\tshrq $2, %rdx");
+    puts("\timulq $100, %rdx, %rax");
+    puts("\tsubq %rax, %rcx");
+    puts("\tmovzwl _vsl_digits(, %rcx, 2), %eax");
+    puts("\tsubq $2, %rsi");
+    puts("\tmovw %ax, (%rsi)");
+    puts("\tmovq %rdx, %rax");
+    puts("\tjmp .Lvsl_write_int_pairs");
+    puts(".Lvsl_write_int_last:");
+    puts("\tcmpq $10, %rax");
+    puts("\tjb .Lvsl_write_int_digit");
+    puts("\tmovzwl _vsl_digits(, %rax, 2), %eax");
+    puts("\tsubq $2, %rsi");
+    puts("\tmovw %ax, (%rsi)");
+    puts("\tjmp .Lvsl_write_int_sign");
+    puts(".Lvsl_write_int_digit:");
+    puts("\taddb $48, %al");  // '0'
+    puts("\tdecq %rsi");
+    puts("\tmovb %al, (%rsi)");
+    puts(".Lvsl_write_int_sign:");
+    puts("\ttestq %rdi, %rdi");
+    puts("\tjns .Lvsl_write_int_done");
+    puts("\tdecq %rsi");
+    puts("\tmovb $45, (%rsi)");  // '-'
+    puts(".Lvsl_write_int_done:");
+    puts("\tmovq %rsi, %rdi");
+    puts("\tleaq 32(%rsp), %rsi");
+    puts("\tsubq %rdi, %rsi");
+    puts("\tcall _vsl_write");
+    puts("\taddq $32, %rsp");
+    puts("\tret");
 }
@@ -0,0 +1,2020 @@
+#include <vslc.h>
+
+// The set of variables a loop may write to
+struct loop_writes {
+    // Symbols that are assigned somewhere inside the loop, keyed
+    // by the symbol pointer itself
+    tlhash_t written;
+    // If the loop contains a function call. The callee may write to
+    // any global variable, so none of them are invariant
+    bool has_call;
+};
+
+// Assignments of expressions that have been moved out of a loop, so that
+// repeated occurrences of the same expression can share one temporary
+struct hoisted_list {
+    size_t count;
+    size_t capacity;
+    node_t **assignments;
+};
+
+/**Recursively finds while loops, replaces the ones that only accumulate
+ * sums by their closed form, reduces the strength of multiplications by
+ * their induction variables and moves their invariant expressions into a
+ * preheader in front of the loop
+ * @param function symbol table entry of the function the node is in
+ * @param slot the child pointer holding the node, so it can be replaced
+ * @return true if any loop was replaced by its closed form */
+static bool optimize_loops(symbol_t *function, node_t **slot);
+/**Moves the invariant expressions of a single while loop
+ * @param function symbol table entry of the function the loop is in
+ * @param slot the child pointer holding the WHILE_STATEMENT node */
+static void hoist_loop_invariants(symbol_t *function, node_t **slot);
+/**Replaces a counted loop that only adds polynomials of its counter to
+ * variables by the sums of the polynomials over all its iterations
+ * @param function symbol table entry of the function the loop is in
+ * @param slot the child pointer holding the WHILE_STATEMENT node
+ * @return true if the loop was replaced */
+static bool replace_by_closed_form(symbol_t *function, node_t **slot);
+/**Replaces the products of induction variables of a single while loop and
+ * invariant factors by temporaries, which are initialized in front of the
+ * loop and stepped along with the induction variables
+ * @param function symbol table entry of the function the loop is in
+ * @param slot the child pointer holding the WHILE_STATEMENT node
+ * @return the child pointer now holding the WHILE_STATEMENT node */
+static node_t **reduce_strength(symbol_t *function, node_t **slot);
+
+/**Replaces reads of variables that are known to hold a constant by the
+ * constant, and removes the branches and loops this decides
+ * @param slot the child pointer holding the body of the function */
+static void propagate_constants(node_t **slot);
+
+/**Replaces calls of functions with constant arguments by their result,
+ * for functions that compute it without any other effects
+ * @param slot the child pointer holding the body of a function
+ * @return true if any call was replaced */
+static bool evaluate_constant_calls(node_t **slot);
+
+/**Makes copies of functions for the constant arguments they are called
+ * with, and lets the call sites with those arguments use the copies
+ * @param global_list the list of global declarations and functions, to
+ *                    which the copies are added */
+static void specialize_functions(node_t *global_list);
+
+// Prefix for the names of temporaries holding hoisted expressions
+#define LICM_PREFIX "__licm"
+// Prefix for the names of temporaries created from the induction variables
+// of loops
+#define SCEV_PREFIX "__scev"
+
+// Set by the -fconstant-propagation flag, defined in vslc.c
+extern bool constant_propagation;
+// Set by the -fipa-cp flag, defined in vslc.c
+extern bool interprocedural_constants;
+// Set by the -fipa-cp-budget=<n> flag, defined in vslc.c. The number of
+// syntax tree nodes all copies of functions together may add
+extern int specialization_budget;
+// Set by the -fevaluate-calls flag, defined in vslc.c
+extern bool evaluate_calls;
+// Set by the -feval-steps=<n> and -feval-depth=<n> flags, defined in
+// vslc.c. The number of nodes evaluating one call may visit, and how deep
+// the calls it makes in turn may nest
+extern int evaluation_steps;
+extern int evaluation_depth;
+// Set by the -fstrength-reduction and -fclosed-form-loops flags, defined in
+// vslc.c
+extern bool strength_reduction;
+extern bool closed_form_loops;
+
+static symbol_t *function_symbol(node_t *global) {
+    symbol_t *function = NULL;
+    char *name = global->children[0]->data;
+    tlhash_lookup(global_names, name, strlen(name), (void **)&function);
+    return function;
+}
+
+/**Simplifies the body of a function with the analyses that only look at
+ * that function and the results of the calls it makes
+ * @param slot the child pointer holding the body of the function */
+static void simplify_function_body(node_t **slot) {
+    if (constant_propagation) {
+        propagate_constants(slot);
+    }
+    // Calls that got evaluated may make more variables constant
+    if (evaluate_calls && evaluate_constant_calls(slot) && constant_propagation) {
+        propagate_constants(slot);
+    }
+}
+
+void optimize_syntax_tree(void) {
+    node_t *global_list = root->children[0];
+
+    // We work on the slot in the tree so the body itself can be replaced,
+    // and keep the symbol table in sync with it. Constants are propagated
+    // within all functions first, so the arguments they make constant can
+    // be propagated into the callees
+    for (size_t i = 0; i < global_list->n_children; i++) {
+        node_t *global = global_list->children[i];
+        if (global->type == FUNCTION) {
+            simplify_function_body(&global->children[2]);
+            function_symbol(global)->node = global->children[2];
+        }
+    }
+
+    if (interprocedural_constants) {
+        specialize_functions(global_list);
+    }
+
+    for (size_t i = 0; i < global_list->n_children; i++) {
+        node_t *global = global_list->children[i];
+        if (global->type != FUNCTION) {
+            continue;
+        }
+
+        // The bounds of loops replaced by their closed form are often
+        // constants, which may decide the rest of the closed form
+        symbol_t *function = function_symbol(global);
+        if (optimize_loops(function, &global->children[2]) && constant_propagation) {
+            propagate_constants(&global->children[2]);
+        }
+        function->node = global->children[2];
+    }
+}
+
+static bool same_expression(node_t *a, node_t *b) {
+    if (a->type != b->type || a->n_children != b->n_children) {
+        return false;
+    }
+
+    switch (a->type) {
+        case NUMBER_DATA:
+            return *((int64_t *)a->data) == *((int64_t *)b->data);
+        case IDENTIFIER_DATA:
+            return a->entry == b->entry;
+        case EXPRESSION:
+            if (a->data == NULL || b->data == NULL || strcmp(a->data, b->data)) {
+                return false;
+            }
+            break;
+        default:
+            return false;
+    }
+
+    for (size_t i = 0; i < a->n_children; i++) {
+        if (!same_expression(a->children[i], b->children[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static node_t *create_node(node_index_t type, void *data, uint64_t n_children) {
+    node_t *node = malloc(sizeof(node_t));
+    *node = (node_t){
+        .type = type,
+        .data = data,
+        .entry = NULL,
+        .n_children = n_children,
+        .children = malloc(n_children * sizeof(node_t *))};
+    return node;
+}
+
+static node_t *create_identifier(symbol_t *sym) {
+    node_t *identifier = create_node(IDENTIFIER_DATA, strdup(sym->name), 0);
+    identifier->entry = sym;
+    return identifier;
+}
+
+/**Adds a new local variable to a function, used to hold intermediate values
+ * @param function symbol table entry of the function
+ * @param prefix prefix of the name of the temporary
+ * @return identifier node referencing the new variable. Like for the locals
+ *         bound in ir.c, the name of the symbol is owned by this node */
+static node_t *create_temporary(symbol_t *function, const char *prefix) {
+    size_t local_num = tlhash_size(function->locals) - function->nparms;
+
+    char name[64];
+    snprintf(name, 64, "%s%lu", prefix, local_num);
+
+    symbol_t *symbol = malloc(sizeof(symbol_t));
+    node_t *identifier = create_node(IDENTIFIER_DATA, strdup(name), 0);
+    *symbol = (symbol_t){
+        .type = SYM_LOCAL_VAR,
+        .name = identifier->data,
+        .node = NULL,
+        .seq = local_num,
+        .nparms = 0,
+        .locals = NULL};
+
+    tlhash_insert(function->locals, &local_num, sizeof(size_t), symbol);
+    identifier->entry = symbol;
+    return identifier;
+}
+
+static void find_loop_writes(node_t *node, struct loop_writes *writes) {
+    if (node == NULL) {
+        return;
+    }
+
+    if (is_assignment(node)) {
+        symbol_t *sym = node->children[0]->entry;
+        // Already existing entries are fine, we only need the key
+        tlhash_insert(&writes->written, &sym, sizeof(symbol_t *), sym);
+    } else if (is_call(node)) {
+        writes->has_call = true;
+    }
+
+    for (size_t i = 0; i < node->n_children; i++) {
+        find_loop_writes(node->children[i], writes);
+    }
+}
+
+static bool is_loop_invariant(node_t *node, struct loop_writes *writes) {
+    void *found;
+    symbol_t *sym;
+
+    switch (node->type) {
+        case NUMBER_DATA:
+            return true;
+        case IDENTIFIER_DATA:
+            sym = node->entry;
+            if (sym->type == SYM_GLOBAL_VAR && writes->has_call) {
+                return false;
+            }
+
+            return tlhash_lookup(&writes->written, &sym, sizeof(symbol_t *), &found) == TLHASH_ENOENT;
+        case EXPRESSION:
+            // Function calls may have side effects and are never moved
+            if (node->data == NULL) {
+                return false;
+            }
+
+            // The loop body may never run, or the division may be guarded by
+            // a condition inside it, so we only move divisions that can not trap
+            if (*((char *)node->data) == '/') {
+                node_t *divisor = node->children[1];
+                if (divisor->type != NUMBER_DATA) {
+                    return false;
+                }
+
+                int64_t value = *((int64_t *)divisor->data);
+                if (value == 0 || value == -1) {
+                    return false;
+                }
+            }
+
+            for (size_t i = 0; i < node->n_children; i++) {
+                if (!is_loop_invariant(node->children[i], writes)) {
+                    return false;
+                }
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_worth_hoisting(node_t *node) {
+    if (node->type != EXPRESSION || node->data == NULL) {
+        return false;
+    }
+
+    // Negating a variable or constant is as cheap as loading the temporary
+    node_t *c1 = node->children[0];
+    return node->n_children == 2 || c1->type == EXPRESSION;
+}
+
+static symbol_t *hoist_expression(symbol_t *function, node_t *expression, struct hoisted_list *hoisted) {
+    node_t *assignment;
+    for (size_t i = 0; i < hoisted->count; i++) {
+        assignment = hoisted->assignments[i];
+        if (same_expression(assignment->children[1], expression)) {
+            destroy_subtree(expression);
+            return assignment->children[0]->entry;
+        }
+    }
+
+    if (hoisted->count == hoisted->capacity) {
+        hoisted->capacity = hoisted->capacity == 0 ? 4 : hoisted->capacity * 2;
+        hoisted->assignments = realloc(hoisted->assignments, hoisted->capacity * sizeof(node_t *));
+    }
+
+    node_t *temporary = create_temporary(function, LICM_PREFIX);
+    assignment = create_node(ASSIGNMENT_STATEMENT, NULL, 2);
+    assignment->children[0] = temporary;
+    assignment->children[1] = expression;
+
+    hoisted->assignments[hoisted->count++] = assignment;
+    return temporary->entry;
+}
+
+static void hoist_invariants(symbol_t *function, node_t **slot, struct loop_writes *writes, struct hoisted_list *hoisted) {
+    node_t *node = *slot;
+    if (node == NULL) {
+        return;
+    }
+
+    if (is_worth_hoisting(node) && is_loop_invariant(node, writes)) {
+        *slot = create_identifier(hoist_expression(function, node, hoisted));
+        return;
+    }
+
+    for (size_t i = 0; i < node->n_children; i++) {
+        hoist_invariants(function, &node->children[i], writes, hoisted);
+    }
+}
+
+void hoist_loop_invariants(symbol_t *function, node_t **slot) {
+    node_t *loop = *slot;
+
+    struct loop_writes writes = {.has_call = false};
+    tlhash_init(&writes.written, 32);
+    find_loop_writes(loop, &writes);
+
+    struct hoisted_list hoisted = {0};
+    hoist_invariants(function, &loop->children[0], &writes, &hoisted);
+    hoist_invariants(function, &loop->children[1], &writes, &hoisted);
+
+    tlhash_finalize(&writes.written);
+
+    if (hoisted.count == 0) {
+        return;
+    }
+
+    // Replace the loop with a list of the preheader assignments, followed
+    // by the loop itself
+    node_t *preheader = create_node(STATEMENT_LIST, NULL, hoisted.count + 1);
+    for (size_t i = 0; i < hoisted.count; i++) {
+        preheader->children[i] = hoisted.assignments[i];
+    }
+    preheader->children[hoisted.count] = loop;
+    *slot = preheader;
+
+    free(hoisted.assignments);
+}
+
+bool optimize_loops(symbol_t *function, node_t **slot) {
+    node_t *node = *slot;
+    if (node == NULL) {
+        return false;
+    }
+
+    if (node->type != WHILE_STATEMENT) {
+        bool replaced = false;
+        for (size_t i = 0; i < node->n_children; i++) {
+            replaced = optimize_loops(function, &node->children[i]) || replaced;
+        }
+        return replaced;
+    }
+
+    // The loop is kept next to its closed form, see create_closed_form,
+    // and left alone there
+    if (closed_form_loops && replace_by_closed_form(function, slot)) {
+        return true;
+    }
+    if (strength_reduction) {
+        slot = reduce_strength(function, slot);
+    }
+
+    // Expressions invariant in this loop are also invariant in all
+    // loops nested inside it, so we hoist them as far out as possible
+    // before looking at the nested loops. This includes the steps of the
+    // temporaries made by strength reduction
+    hoist_loop_invariants(function, slot);
+    return optimize_loops(function, &node->children[1]);
+}
+
+// What is known about the value of a variable at a point in a function
+struct lattice_value_t {
+    bool constant;
+    int64_t value;
+};
+
+// What is known about all variables of a function at a point in it
+struct propagation_state_t {
+    // Unreachable points know everything, they don't add to a merge
+    bool reachable;
+    struct lattice_value_t *values;
+};
+
+// Constant propagation over the body of one function
+struct propagation_t {
+    // Index of each variable used in the function, plus one, keyed by the
+    // symbol pointer
+    tlhash_t variables;
+    symbol_t **symbols;
+    size_t n_variables;
+    // The value read by each identifier node, keyed by the node pointer.
+    // Reads inside loops are recorded again on each pass over the body, so
+    // the last pass, which sees the final state of the loop, decides
+    tlhash_t reads;
+    // Where a continue statement in the loop being analyzed goes
+    struct propagation_state_t *continue_state;
+};
+
+static const struct lattice_value_t VARYING = {.constant = false, .value = 0};
+
+static void collect_variables(node_t *node, struct propagation_t *propagation) {
+    if (node == NULL || node->type == DECLARATION) {
+        return;
+    }
+
+    void *found;
+    symbol_t *sym = node->entry;
+    if (node->type == IDENTIFIER_DATA && sym->type != SYM_FUNCTION &&
+        tlhash_lookup(&propagation->variables, &sym, sizeof(symbol_t *), &found) == TLHASH_ENOENT) {
+        propagation->symbols = realloc(propagation->symbols, (propagation->n_variables + 1) * sizeof(symbol_t *));
+        propagation->symbols[propagation->n_variables++] = sym;
+        tlhash_insert(&propagation->variables, &sym, sizeof(symbol_t *), (void *)(uintptr_t)propagation->n_variables);
+    }
+
+    for (size_t i = 0; i < node->n_children; i++) {
+        collect_variables(node->children[i], propagation);
+    }
+}
+
+static size_t variable_index(struct propagation_t *propagation, symbol_t *sym) {
+    void *index;
+    tlhash_lookup(&propagation->variables, &sym, sizeof(symbol_t *), &index);
+    return (uintptr_t)index - 1;
+}
+
+static struct propagation_state_t create_state(struct propagation_t *propagation, bool reachable) {
+    struct propagation_state_t state = {
+        .reachable = reachable,
+        .values = malloc((propagation->n_variables + 1) * sizeof(struct lattice_value_t))};
+    for (size_t i = 0; i < propagation->n_variables; i++) {
+        state.values[i] = VARYING;
+    }
+    return state;
+}
+
+static struct propagation_state_t copy_state(struct propagation_t *propagation, struct propagation_state_t *state) {
+    struct propagation_state_t copy = create_state(propagation, state->reachable);
+    memcpy(copy.values, state->values, propagation->n_variables * sizeof(struct lattice_value_t));
+    return copy;
+}
+
+/**Merges what is known along another path into a state
+ * @param propagation the propagation
+ * @param state the state to merge into
+ * @param other the state along the other path
+ * @return true if the state changed */
+static bool merge_state(struct propagation_t *propagation, struct propagation_state_t *state,
+                        struct propagation_state_t *other) {
+    if (!other->reachable) {
+        return false;
+    }
+
+    if (!state->reachable) {
+        memcpy(state->values, other->values, propagation->n_variables * sizeof(struct lattice_value_t));
+        state->reachable = true;
+        return true;
+    }
+
+    bool changed = false;
+    for (size_t i = 0; i < propagation->n_variables; i++) {
+        struct lattice_value_t *value = &state->values[i];
+        if (value->constant && (!other->values[i].constant || other->values[i].value != value->value)) {
+            *value = VARYING;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/**Forgets the values of the globals, which a call may change */
+static void clobber_globals(struct propagation_t *propagation, struct propagation_state_t *state) {
+    for (size_t i = 0; i < propagation->n_variables; i++) {
+        if (propagation->symbols[i]->type == SYM_GLOBAL_VAR) {
+            state->values[i] = VARYING;
+        }
+    }
+}
+
+static bool contains_call(node_t *node) {
+    if (node == NULL) {
+        return false;
+    }
+    if (is_call(node)) {
+        return true;
+    }
+    for (size_t i = 0; i < node->n_children; i++) {
+        if (contains_call(node->children[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void record_read(struct propagation_t *propagation, node_t *identifier, struct lattice_value_t value) {
+    struct lattice_value_t *recorded;
+    if (tlhash_lookup(&propagation->reads, &identifier, sizeof(node_t *), (void **)&recorded) == TLHASH_ENOENT) {
+        recorded = malloc(sizeof(struct lattice_value_t));
+        tlhash_insert(&propagation->reads, &identifier, sizeof(node_t *), recorded);
+    }
+    *recorded = value;
+}
+
+/**Finds the value of an expression
+ * @param propagation the propagation
+ * @param node the expression
+ * @param state what is known before the expression
+ * @param has_call if the whole expression calls a function. Calls are made
+ *                 in between the reads, so none of the globals are known */
+static struct lattice_value_t evaluate(struct propagation_t *propagation, node_t *node,
+                                       struct propagation_state_t *state, bool has_call) {
+    struct lattice_value_t value = VARYING;
+    symbol_t *sym;
+
+    switch (node->type) {
+        case NUMBER_DATA:
+            return (struct lattice_value_t){.constant = true, .value = *((int64_t *)node->data)};
+        case IDENTIFIER_DATA:
+            sym = node->entry;
+            if (sym->type != SYM_GLOBAL_VAR || !has_call) {
+                value = state->values[variable_index(propagation, sym)];
+            }
+            record_read(propagation, node, value);
+            return value;
+        case EXPRESSION:
+            break;
+        default:
+            return VARYING;
+    }
+
+    if (is_call(node)) {
+        node_t *arguments = node->children[1];
+        for (size_t i = 0; arguments != NULL && i < arguments->n_children; i++) {
+            evaluate(propagation, arguments->children[i], state, has_call);
+        }
+        return VARYING;
+    }
+
+    struct lattice_value_t operands[2];
+    for (size_t i = 0; i < node->n_children; i++) {
+        operands[i] = evaluate(propagation, node->children[i], state, has_call);
+    }
+
+    char op = *((char *)node->data);
+    if (node->n_children == 1 && operands[0].constant) {
+        value.constant = true;
+        value.value = op == '~' ? ~operands[0].value : (int64_t)(0 - (uint64_t)operands[0].value);
+    } else if (node->n_children == 2 && operands[0].constant && operands[1].constant) {
+        value.constant = fold_constants(op, operands[0].value, operands[1].value, &value.value);
+    }
+    return value;
+}
+
+/**Evaluates an expression that is part of a statement, and forgets the
+ * globals afterwards if it made calls
+ * @return the value of the expression */
+static struct lattice_value_t evaluate_statement_part(struct propagation_t *propagation, node_t *node,
+                                                      struct propagation_state_t *state) {
+    bool has_call = contains_call(node);
+    struct lattice_value_t value = evaluate(propagation, node, state, has_call);
+    if (has_call) {
+        clobber_globals(propagation, state);
+    }
+    return value;
+}
+
+/**Finds the outcome of a relation
+ * @return 1 if it holds, 0 if it doesn't, -1 if it isn't known */
+static int evaluate_relation(struct propagation_t *propagation, node_t *relation, struct propagation_state_t *state) {
+    // The operands of relations are evaluated left to right
+    struct lattice_value_t lhs = evaluate_statement_part(propagation, relation->children[0], state);
+    struct lattice_value_t rhs = evaluate_statement_part(propagation, relation->children[1], state);
+    if (!lhs.constant || !rhs.constant) {
+        return -1;
+    }
+
+    switch (*((char *)relation->data)) {
+        case '=':
+            return lhs.value == rhs.value;
+        case '<':
+            return lhs.value < rhs.value;
+        case '>':
+            return lhs.value > rhs.value;
+        default:
+            return -1;
+    }
+}
+
+static void propagate_statement(struct propagation_t *propagation, node_t *node, struct propagation_state_t *state);
+
+static void propagate_if_statement(struct propagation_t *propagation, node_t *node, struct propagation_state_t *state) {
+    int outcome = evaluate_relation(propagation, node->children[0], state);
+
+    // Only the branch that can be taken is followed, so assignments in the
+    // other one don't spoil what is known after the if-statement
+    if (outcome == 1) {
+        propagate_statement(propagation, node->children[1], state);
+        return;
+    }
+    if (outcome == 0) {
+        if (node->n_children == 3) {
+            propagate_statement(propagation, node->children[2], state);
+        }
+        return;
+    }
+
+    struct propagation_state_t else_state = copy_state(propagation, state);
+    propagate_statement(propagation, node->children[1], state);
+    if (node->n_children == 3) {
+        propagate_statement(propagation, node->children[2], &else_state);
+    }
+    merge_state(propagation, state, &else_state);
+    free(else_state.values);
+}
+
+static void propagate_while_statement(struct propagation_t *propagation, node_t *node,
+                                      struct propagation_state_t *state) {
+    // The state at the test starts out as the one on entry, and takes in
+    // the ones at the end of the body and at continue statements until
+    // nothing changes. Each variable can only go from constant to varying,
+    // so this ends after a few passes
+    struct propagation_state_t head = copy_state(propagation, state);
+    struct propagation_state_t *surrounding_continue = propagation->continue_state;
+    state->reachable = false;
+
+    bool changed = true;
+    while (changed) {
+        struct propagation_state_t test = copy_state(propagation, &head);
+        int outcome = evaluate_relation(propagation, node->children[0], &test);
+
+        // The loop is left when the test fails
+        struct propagation_state_t exit = copy_state(propagation, &test);
+        exit.reachable = test.reachable && outcome != 1;
+
+        struct propagation_state_t back = create_state(propagation, false);
+        if (outcome != 0) {
+            propagation->continue_state = &back;
+            propagate_statement(propagation, node->children[1], &test);
+            merge_state(propagation, &back, &test);
+        }
+
+        changed = merge_state(propagation, &head, &back);
+        if (!changed) {
+            merge_state(propagation, state, &exit);
+        }
+
+        free(test.values);
+        free(exit.values);
+        free(back.values);
+    }
+
+    propagation->continue_state = surrounding_continue;
+    free(head.values);
+}
+
+void propagate_statement(struct propagation_t *propagation, node_t *node, struct propagation_state_t *state) {
+    if (node == NULL || !state->reachable) {
+        return;
+    }
+
+    struct lattice_value_t value;
+    size_t index;
+    int64_t combined;
+
+    switch (node->type) {
+        case DECLARATION_LIST:
+        case DECLARATION:
+            return;
+        case ASSIGNMENT_STATEMENT:
+        case ADD_STATEMENT:
+        case SUBTRACT_STATEMENT:
+        case MULTIPLY_STATEMENT:
+        case DIVIDE_STATEMENT:
+            value = evaluate_statement_part(propagation, node->children[1], state);
+            index = variable_index(propagation, node->children[0]->entry);
+            if (node->type != ASSIGNMENT_STATEMENT) {
+                char op = node->type == ADD_STATEMENT        ? '+'
+                          : node->type == SUBTRACT_STATEMENT ? '-'
+                          : node->type == MULTIPLY_STATEMENT ? '*'
+                                                             : '/';
+                struct lattice_value_t current = state->values[index];
+                value.constant = value.constant && current.constant &&
+                                 fold_constants(op, current.value, value.value, &combined);
+                value.value = combined;
+            }
+            state->values[index] = value;
+            return;
+        case PRINT_STATEMENT:
+            for (size_t i = 0; i < node->n_children; i++) {
+                evaluate_statement_part(propagation, node->children[i], state);
+            }
+            return;
+        case RETURN_STATEMENT:
+            evaluate_statement_part(propagation, node->children[0], state);
+            state->reachable = false;
+            return;
+        case NULL_STATEMENT:
+            if (propagation->continue_state != NULL) {
+                merge_state(propagation, propagation->continue_state, state);
+            }
+            state->reachable = false;
+            return;
+        case IF_STATEMENT:
+            propagate_if_statement(propagation, node, state);
+            return;
+        case WHILE_STATEMENT:
+            propagate_while_statement(propagation, node, state);
+            return;
+        case BLOCK:
+        case STATEMENT_LIST:
+            for (size_t i = 0; i < node->n_children; i++) {
+                propagate_statement(propagation, node->children[i], state);
+            }
+            return;
+        default:
+            evaluate_statement_part(propagation, node, state);
+            return;
+    }
+}
+
+static void substitute_constants(struct propagation_t *propagation, node_t **slot) {
+    node_t *node = *slot;
+    if (node == NULL) {
+        return;
+    }
+
+    struct lattice_value_t *read;
+    if (node->type == IDENTIFIER_DATA &&
+        tlhash_lookup(&propagation->reads, &node, sizeof(node_t *), (void **)&read) == TLHASH_SUCCESS) {
+        if (read->constant) {
+            int64_t *value = malloc(sizeof(int64_t));
+            *value = read->value;
+            *slot = create_node(NUMBER_DATA, value, 0);
+            destroy_subtree(node);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < node->n_children; i++) {
+        substitute_constants(propagation, &node->children[i]);
+    }
+}
+
+void propagate_constants(node_t **slot) {
+    struct propagation_t propagation = {.symbols = NULL, .n_variables = 0, .continue_state = NULL};
+    tlhash_init(&propagation.variables, 32);
+    tlhash_init(&propagation.reads, 64);
+    collect_variables(*slot, &propagation);
+
+    // Nothing is known about parameters and globals on entry. Locals are
+    // not initialized either
+    struct propagation_state_t state = create_state(&propagation, true);
+    propagate_statement(&propagation, *slot, &state);
+    free(state.values);
+
+    // Reads that were never reached are not recorded, and are left alone.
+    // Folding the constants then removes the branches they decide
+    substitute_constants(&propagation, slot);
+    fold_subtree(slot);
+
+    size_t n_reads = tlhash_size(&propagation.reads);
+    struct lattice_value_t *reads[n_reads + 1];
+    tlhash_values(&propagation.reads, (void **)reads);
+    for (size_t i = 0; i < n_reads; i++) {
+        free(reads[i]);
+    }
+    tlhash_finalize(&propagation.reads);
+    tlhash_finalize(&propagation.variables);
+    free(propagation.symbols);
+}
+
+// Copies of functions for constant arguments, made while specializing
+struct specialization_t {
+    node_t *global_list;
+    // The copies made so far, keyed by name
+    tlhash_t copies;
+    // The number of nodes the copies may still add
+    int budget;
+    size_t next_seq;
+};
+
+static size_t count_nodes(node_t *node) {
+    if (node == NULL) {
+        return 0;
+    }
+    size_t count = 1;
+    for (size_t i = 0; i < node->n_children; i++) {
+        count += count_nodes(node->children[i]);
+    }
+    return count;
+}
+
+/**Checks if knowing the value of a parameter helps simplifying a function,
+ * which is when it is an operand, or passed on to another function that
+ * may be specialized for it in turn */
+static bool has_foldable_use(node_t *node, symbol_t *parameter) {
+    if (node == NULL) {
+        return false;
+    }
+
+    node_t *operands = NULL;
+    if (is_call(node)) {
+        operands = node->children[1];
+    } else if (node->type == RELATION || (node->type == EXPRESSION && node->data != NULL)) {
+        operands = node;
+    }
+    for (size_t i = 0; operands != NULL && i < operands->n_children; i++) {
+        if (operands->children[i]->type == IDENTIFIER_DATA && operands->children[i]->entry == parameter) {
+            return true;
+        }
+    }
+
+    for (size_t i = 0; i < node->n_children; i++) {
+        if (has_foldable_use(node->children[i], parameter)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**Copies a subtree, letting identifiers refer to the symbols they are mapped
+ * to in the copy
+ * @param node the subtree
+ * @param symbols maps the symbols of the original function to the ones of
+ *                the copy, keyed by the symbol pointers, or NULL to keep them
+ * @return the copy */
+static node_t *copy_subtree(node_t *node, tlhash_t *symbols) {
+    if (node == NULL) {
+        return NULL;
+    }
+
+    void *data = NULL;
+    switch (node->type) {
+        case NUMBER_DATA:
+            data = malloc(sizeof(int64_t));
+            *((int64_t *)data) = *((int64_t *)node->data);
+            break;
+        case STRING_DATA:
+            // Strings are moved to the string list in ir.c, which leaves
+            // their index in the node
+            data = malloc(sizeof(size_t));
+            *((size_t *)data) = *((size_t *)node->data);
+            break;
+        default:
+            if (node->data != NULL) {
+                data = strdup(node->data);
+            }
+            break;
+    }
+
+    node_t *copy = create_node(node->type, data, node->n_children);
+    symbol_t *mapped;
+    copy->entry = node->entry;
+    if (node->entry != NULL && symbols != NULL &&
+        tlhash_lookup(symbols, &node->entry, sizeof(symbol_t *), (void **)&mapped) == TLHASH_SUCCESS) {
+        copy->entry = mapped;
+    }
+    for (size_t i = 0; i < node->n_children; i++) {
+        copy->children[i] = copy_subtree(node->children[i], symbols);
+    }
+    return copy;
+}
+
+static void append_to_name(char **name, const char *format, const char *text, int64_t value) {
+    size_t length = strlen(*name);
+    size_t extra = snprintf(NULL, 0, format, text, value);
+    *name = realloc(*name, length + extra + 1);
+    snprintf(*name + length, extra + 1, format, text, value);
+}
+
+/**Names the copy of a function for some constant arguments after the
+ * parameters and their values, like f__n_10. Negative values are written
+ * with m for minus, as a name can't hold a '-' */
+static char *specialized_name(symbol_t *function, symbol_t **parameters, bool *constant, int64_t *values) {
+    char *name = strdup(function->name);
+    for (size_t i = 0; i < function->nparms; i++) {
+        if (!constant[i]) {
+            continue;
+        }
+        if (values[i] < 0) {
+            append_to_name(&name, "__%s_m%lu", parameters[i]->name, (int64_t)(0 - (uint64_t)values[i]));
+        } else {
+            append_to_name(&name, "__%s_%ld", parameters[i]->name, values[i]);
+        }
+    }
+    return name;
+}
+
+/**Makes a copy of a function where some parameters are replaced by local
+ * variables holding constants. The copy starts by assigning them, and
+ * propagating constants takes it from there
+ * @param specialization the specialization
+ * @param function the function to copy
+ * @param parameters the parameters of the function, in order
+ * @param constant which parameters are replaced
+ * @param values the constants to replace them by
+ * @param name the name of the copy, which the copy takes over
+ * @return symbol table entry of the copy */
+static symbol_t *copy_function(struct specialization_t *specialization, symbol_t *function,
+                               symbol_t **parameters, bool *constant, int64_t *values, char *name) {
+    symbol_t *copy = malloc(sizeof(symbol_t));
+    node_t *identifier = create_node(IDENTIFIER_DATA, name, 0);
+    *copy = (symbol_t){
+        .type = SYM_FUNCTION,
+        .name = name,
+        .node = NULL,
+        .seq = specialization->next_seq++,
+        .nparms = 0,
+        .locals = malloc(sizeof(tlhash_t))};
+    tlhash_init(copy->locals, 32);
+
+    tlhash_t symbols;
+    tlhash_init(&symbols, 32);
+
+    // The parameters that are kept, numbered again. Like in ir.c, their
+    // names are owned by the parameter list
+    node_t *parameter_list = NULL;
+    for (size_t i = 0; i < function->nparms; i++) {
+        if (!constant[i]) {
+            copy->nparms++;
+        }
+    }
+    if (copy->nparms > 0) {
+        parameter_list = create_node(VARIABLE_LIST, NULL, copy->nparms);
+    }
+    for (size_t i = 0, seq = 0; i < function->nparms; i++) {
+        if (constant[i]) {
+            continue;
+        }
+        node_t *parameter = create_node(IDENTIFIER_DATA, strdup(parameters[i]->name), 0);
+        parameter_list->children[seq] = parameter;
+
+        symbol_t *symbol = malloc(sizeof(symbol_t));
+        *symbol = *parameters[i];
+        symbol->name = parameter->data;
+        symbol->seq = seq++;
+        tlhash_insert(copy->locals, symbol->name, strlen(symbol->name), symbol);
+        tlhash_insert(&symbols, &parameters[i], sizeof(symbol_t *), symbol);
+    }
+
+    // The locals keep their numbers, the replaced parameters come after them.
+    // Their names are those of the original function, which stays in the tree
+    size_t n_locals = tlhash_size(function->locals);
+    symbol_t *locals[n_locals + 1];
+    tlhash_values(function->locals, (void **)locals);
+    for (size_t i = 0; i < n_locals; i++) {
+        if (locals[i]->type != SYM_LOCAL_VAR) {
+            continue;
+        }
+        symbol_t *symbol = malloc(sizeof(symbol_t));
+        *symbol = *locals[i];
+        tlhash_insert(copy->locals, &symbol->seq, sizeof(size_t), symbol);
+        tlhash_insert(&symbols, &locals[i], sizeof(symbol_t *), symbol);
+    }
+
+    node_t *body = create_node(STATEMENT_LIST, NULL, function->nparms - copy->nparms + 1);
+    for (size_t i = 0, n = 0; i < function->nparms; i++) {
+        if (!constant[i]) {
+            continue;
+        }
+        size_t local_num = tlhash_size(copy->locals) - copy->nparms;
+        symbol_t *symbol = malloc(sizeof(symbol_t));
+        *symbol = (symbol_t){
+            .type = SYM_LOCAL_VAR,
+            .name = parameters[i]->name,
+            .node = NULL,
+            .seq = local_num,
+            .nparms = 0,
+            .locals = NULL};
+        tlhash_insert(copy->locals, &local_num, sizeof(size_t), symbol);
+        tlhash_insert(&symbols, &parameters[i], sizeof(symbol_t *), symbol);
+
+        int64_t *value = malloc(sizeof(int64_t));
+        *value = values[i];
+        node_t *assignment = create_node(ASSIGNMENT_STATEMENT, NULL, 2);
+        assignment->children[0] = create_identifier(symbol);
+        assignment->children[1] = create_node(NUMBER_DATA, value, 0);
+        body->children[n++] = assignment;
+    }
+    body->children[body->n_children - 1] = copy_subtree(function->node, &symbols);
+    tlhash_finalize(&symbols);
+
+    node_t *global = create_node(FUNCTION, NULL, 3);
+    global->children[0] = identifier;
+    global->children[1] = parameter_list;
+    global->children[2] = body;
+    copy->node = body;
+    simplify_function_body(&global->children[2]);
+    copy->node = global->children[2];
+
+    node_t *global_list = specialization->global_list;
+    global_list->n_children++;
+    global_list->children = realloc(global_list->children, global_list->n_children * sizeof(node_t *));
+    global_list->children[global_list->n_children - 1] = global;
+
+    tlhash_insert(global_names, copy->name, strlen(copy->name), copy);
+    tlhash_insert(&specialization->copies, copy->name, strlen(copy->name), copy);
+    return copy;
+}
+
+/**Lets a call with constant arguments use a copy of the callee that is
+ * specialized for them, making the copy if needed
+ * @param specialization the specialization
+ * @param call the EXPRESSION node of the call
+ * @return true if the call was changed */
+static bool specialize_call(struct specialization_t *specialization, node_t *call) {
+    symbol_t *function = call->children[0]->entry;
+    node_t *arguments = call->children[1];
+    size_t n_arguments = arguments == NULL ? 0 : arguments->n_children;
+    if (function == NULL || function->type != SYM_FUNCTION || n_arguments != function->nparms || n_arguments == 0) {
+        return false;
+    }
+
+    symbol_t *parameters[n_arguments];
+    size_t n_locals = tlhash_size(function->locals);
+    symbol_t *locals[n_locals];
+    tlhash_values(function->locals, (void **)locals);
+    for (size_t i = 0; i < n_locals; i++) {
+        if (locals[i]->type == SYM_PARAMETER) {
+            parameters[locals[i]->seq] = locals[i];
+        }
+    }
+
+    bool constant[n_arguments], any = false;
+    int64_t values[n_arguments];
+    for (size_t i = 0; i < n_arguments; i++) {
+        node_t *argument = arguments->children[i];
+        constant[i] = argument->type == NUMBER_DATA && has_foldable_use(function->node, parameters[i]);
+        values[i] = constant[i] ? *((int64_t *)argument->data) : 0;
+        any = any || constant[i];
+    }
+    if (!any) {
+        return false;
+    }
+
+    char *name = specialized_name(function, parameters, constant, values);
+    symbol_t *copy = NULL;
+    if (tlhash_lookup(&specialization->copies, name, strlen(name), (void **)&copy) == TLHASH_SUCCESS) {
+        free(name);
+    } else {
+        void *existing;
+        int size = (int)count_nodes(function->node);
+        if (size > specialization->budget ||
+            tlhash_lookup(global_names, name, strlen(name), &existing) == TLHASH_SUCCESS) {
+            free(name);
+            return false;
+        }
+        specialization->budget -= size;
+        copy = copy_function(specialization, function, parameters, constant, values, name);
+    }
+
+    // The call passes only the arguments the copy still has
+    size_t kept = 0;
+    for (size_t i = 0; i < n_arguments; i++) {
+        if (constant[i]) {
+            destroy_subtree(arguments->children[i]);
+        } else {
+            arguments->children[kept++] = arguments->children[i];
+        }
+    }
+    arguments->n_children = kept;
+    if (kept == 0) {
+        destroy_subtree(arguments);
+        call->children[1] = NULL;
+    }
+
+    node_t *callee = call->children[0];
+    free(callee->data);
+    callee->data = strdup(copy->name);
+    callee->entry = copy;
+    return true;
+}
+
+static bool specialize_calls(struct specialization_t *specialization, node_t *node) {
+    if (node == NULL) {
+        return false;
+    }
+
+    bool changed = false;
+    for (size_t i = 0; i < node->n_children; i++) {
+        changed = specialize_calls(specialization, node->children[i]) || changed;
+    }
+    if (is_call(node)) {
+        changed = specialize_call(specialization, node) || changed;
+    }
+    return changed;
+}
+
+void specialize_functions(node_t *global_list) {
+    struct specialization_t specialization = {
+        .global_list = global_list,
+        .budget = specialization_budget,
+        .next_seq = 0};
+    tlhash_init(&specialization.copies, 32);
+
+    for (size_t i = 0; i < global_list->n_children; i++) {
+        if (global_list->children[i]->type == FUNCTION) {
+            symbol_t *function = function_symbol(global_list->children[i]);
+            if (function->seq >= specialization.next_seq) {
+                specialization.next_seq = function->seq + 1;
+            }
+        }
+    }
+
+    // Copies made for constant arguments may pass constant arguments on in
+    // turn, so this goes on through the new copies until nothing changes.
+    // Calls only ever lose constant arguments, and copies use up the
+    // budget, so that happens
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < global_list->n_children; i++) {
+            node_t *global = global_list->children[i];
+            if (global->type == FUNCTION) {
+                changed = specialize_calls(&specialization, global->children[2]) || changed;
+            }
+        }
+    }
+
+    tlhash_finalize(&specialization.copies);
+}
+
+// How running a statement at compile time ended
+typedef enum {
+    EVALUATED_NEXT,
+    EVALUATED_RETURN,
+    EVALUATED_CONTINUE,
+    // The statement has effects, depends on what is only known at run
+    // time, traps or goes over the budget
+    EVALUATION_FAILED
+} evaluation_result_t;
+
+// The state of evaluating one call at compile time
+struct evaluation_t {
+    size_t steps;
+    size_t depth;
+};
+
+// The variables of one function being evaluated, numbered like the stack
+// slots: parameters first, then locals
+struct evaluation_frame_t {
+    symbol_t *function;
+    int64_t *values;
+    bool *assigned;
+};
+
+static bool evaluate_expression(struct evaluation_t *evaluation, struct evaluation_frame_t *frame, node_t *node,
+                                int64_t *value);
+
+static bool frame_index(struct evaluation_frame_t *frame, symbol_t *sym, size_t *index) {
+    switch (sym->type) {
+        case SYM_PARAMETER:
+            *index = sym->seq;
+            return true;
+        case SYM_LOCAL_VAR:
+            *index = frame->function->nparms + sym->seq;
+            return true;
+        default:
+            // Globals may change before the call is run
+            return false;
+    }
+}
+
+/**Evaluates a call of a function, with the arguments already evaluated
+ * @return false if the call can't be evaluated at compile time */
+static bool evaluate_call(struct evaluation_t *evaluation, symbol_t *function, int64_t *arguments,
+                          size_t n_arguments, int64_t *result);
+
+static bool evaluate_expression(struct evaluation_t *evaluation, struct evaluation_frame_t *frame, node_t *node,
+                                int64_t *value) {
+    if (++evaluation->steps > (size_t)evaluation_steps) {
+        return false;
+    }
+
+    size_t index;
+    switch (node->type) {
+        case NUMBER_DATA:
+            *value = *((int64_t *)node->data);
+            return true;
+        case IDENTIFIER_DATA:
+            if (!frame_index(frame, node->entry, &index) || !frame->assigned[index]) {
+                return false;
+            }
+            *value = frame->values[index];
+            return true;
+        case EXPRESSION:
+            break;
+        default:
+            return false;
+    }
+
+    if (is_call(node)) {
+        node_t *list = node->children[1];
+        size_t n_arguments = list == NULL ? 0 : list->n_children;
+        int64_t arguments[n_arguments + 1];
+        for (size_t i = 0; i < n_arguments; i++) {
+            if (!evaluate_expression(evaluation, frame, list->children[i], &arguments[i])) {
+                return false;
+            }
+        }
+        return evaluate_call(evaluation, node->children[0]->entry, arguments, n_arguments, value);
+    }
+
+    int64_t operands[2];
+    for (size_t i = 0; i < node->n_children; i++) {
+        if (!evaluate_expression(evaluation, frame, node->children[i], &operands[i])) {
+            return false;
+        }
+    }
+
+    char op = *((char *)node->data);
+    if (node->n_children == 1) {
+        *value = op == '~' ? ~operands[0] : (int64_t)(0 - (uint64_t)operands[0]);
+        return true;
+    }
+    return fold_constants(op, operands[0], operands[1], value);
+}
+
+static evaluation_result_t evaluate_statement(struct evaluation_t *evaluation, struct evaluation_frame_t *frame,
+                                              node_t *node, int64_t *result) {
+    if (node == NULL) {
+        return EVALUATED_NEXT;
+    }
+    if (++evaluation->steps > (size_t)evaluation_steps) {
+        return EVALUATION_FAILED;
+    }
+
+    int64_t value, lhs, rhs;
+    size_t index;
+    evaluation_result_t outcome;
+    bool holds;
+
+    switch (node->type) {
+        case DECLARATION_LIST:
+            return EVALUATED_NEXT;
+        case ASSIGNMENT_STATEMENT:
+        case ADD_STATEMENT:
+        case SUBTRACT_STATEMENT:
+        case MULTIPLY_STATEMENT:
+        case DIVIDE_STATEMENT:
+            if (!evaluate_expression(evaluation, frame, node->children[1], &value) ||
+                !frame_index(frame, node->children[0]->entry, &index)) {
+                return EVALUATION_FAILED;
+            }
+            if (node->type != ASSIGNMENT_STATEMENT) {
+                char op = node->type == ADD_STATEMENT        ? '+'
+                          : node->type == SUBTRACT_STATEMENT ? '-'
+                          : node->type == MULTIPLY_STATEMENT ? '*'
+                                                             : '/';
+                if (!frame->assigned[index] || !fold_constants(op, frame->values[index], value, &value)) {
+                    return EVALUATION_FAILED;
+                }
+            }
+            frame->values[index] = value;
+            frame->assigned[index] = true;
+            return EVALUATED_NEXT;
+        case RETURN_STATEMENT:
+            if (!evaluate_expression(evaluation, frame, node->children[0], result)) {
+                return EVALUATION_FAILED;
+            }
+            return EVALUATED_RETURN;
+        case NULL_STATEMENT:
+            return EVALUATED_CONTINUE;
+        case IF_STATEMENT:
+        case WHILE_STATEMENT:
+            do {
+                node_t *relation = node->children[0];
+                if (!evaluate_expression(evaluation, frame, relation->children[0], &lhs) ||
+                    !evaluate_expression(evaluation, frame, relation->children[1], &rhs)) {
+                    return EVALUATION_FAILED;
+                }
+                switch (*((char *)relation->data)) {
+                    case '=':
+                        holds = lhs == rhs;
+                        break;
+                    case '<':
+                        holds = lhs < rhs;
+                        break;
+                    default:
+                        holds = lhs > rhs;
+                        break;
+                }
+
+                if (node->type == IF_STATEMENT) {
+                    node_t *taken = holds ? node->children[1] : node->n_children == 3 ? node->children[2] : NULL;
+                    return evaluate_statement(evaluation, frame, taken, result);
+                }
+                if (!holds) {
+                    return EVALUATED_NEXT;
+                }
+                outcome = evaluate_statement(evaluation, frame, node->children[1], result);
+            } while (outcome == EVALUATED_NEXT || outcome == EVALUATED_CONTINUE);
+            return outcome;
+        case BLOCK:
+        case STATEMENT_LIST:
+            for (size_t i = 0; i < node->n_children; i++) {
+                outcome = evaluate_statement(evaluation, frame, node->children[i], result);
+                if (outcome != EVALUATED_NEXT) {
+                    return outcome;
+                }
+            }
+            return EVALUATED_NEXT;
+        default:
+            // Prints, and anything else that has an effect
+            return EVALUATION_FAILED;
+    }
+}
+
+bool evaluate_call(struct evaluation_t *evaluation, symbol_t *function, int64_t *arguments, size_t n_arguments,
+                   int64_t *result) {
+    if (function->type != SYM_FUNCTION || function->nparms != n_arguments ||
+        evaluation->depth >= (size_t)evaluation_depth) {
+        return false;
+    }
+
+    size_t n_variables = tlhash_size(function->locals);
+    int64_t values[n_variables + 1];
+    bool assigned[n_variables + 1];
+    for (size_t i = 0; i < n_variables; i++) {
+        values[i] = i < n_arguments ? arguments[i] : 0;
+        assigned[i] = i < n_arguments;
+    }
+    struct evaluation_frame_t frame = {.function = function, .values = values, .assigned = assigned};
+
+    // Running off the end of a function returns no defined value
+    evaluation->depth++;
+    evaluation_result_t outcome = evaluate_statement(evaluation, &frame, function->node, result);
+    evaluation->depth--;
+    return outcome == EVALUATED_RETURN;
+}
+
+bool evaluate_constant_calls(node_t **slot) {
+    node_t *node = *slot;
+    if (node == NULL) {
+        return false;
+    }
+
+    bool changed = false;
+    for (size_t i = 0; i < node->n_children; i++) {
+        changed = evaluate_constant_calls(&node->children[i]) || changed;
+    }
+    if (!is_call(node)) {
+        return changed;
+    }
+
+    node_t *list = node->children[1];
+    size_t n_arguments = list == NULL ? 0 : list->n_children;
+    int64_t arguments[n_arguments + 1];
+    for (size_t i = 0; i < n_arguments; i++) {
+        if (list->children[i]->type != NUMBER_DATA) {
+            return changed;
+        }
+        arguments[i] = *((int64_t *)list->children[i]->data);
+    }
+
+    // Each call gets a budget of its own
+    struct evaluation_t evaluation = {.steps = 0, .depth = 0};
+    int64_t *result = malloc(sizeof(int64_t));
+    if (!evaluate_call(&evaluation, node->children[0]->entry, arguments, n_arguments, result)) {
+        free(result);
+        return changed;
+    }
+
+    *slot = create_node(NUMBER_DATA, result, 0);
+    destroy_subtree(node);
+    return true;
+}
+
+// Loops are analysed in terms of their basic induction variables: local
+// variables stepped by a constant in a top level statement of the body, which
+// nothing else in the loop assigns to. Their value in iteration k of the loop
+// is a linear function of k, and so are products of them with invariants
+
+// A polynomial in the number of iterations a loop has run, with coefficients
+// that are invariant in the loop. Coefficients that are zero are NULL
+#define MAX_DEGREE 2
+struct polynomial_t {
+    node_t *coefficients[MAX_DEGREE + 1];
+};
+
+// Multiplications of induction variables by invariant factors that are
+// replaced by temporaries stepped along with the variables
+struct reduction_list {
+    size_t count;
+    size_t capacity;
+    // Assignments of the products to the temporaries, in front of the loop
+    node_t **initializations;
+};
+
+static node_t *create_number(int64_t value) {
+    int64_t *data = malloc(sizeof(int64_t));
+    *data = value;
+    return create_node(NUMBER_DATA, data, 0);
+}
+
+/**Creates an operator or relation node
+ * @param type EXPRESSION or RELATION
+ * @param op the operator
+ * @param left the first operand
+ * @param right the second operand, or NULL for unary operators */
+static node_t *create_operation(node_index_t type, const char *op, node_t *left, node_t *right) {
+    node_t *node = create_node(type, strdup(op), right == NULL ? 1 : 2);
+    node->children[0] = left;
+    if (right != NULL) {
+        node->children[1] = right;
+    }
+    return node;
+}
+
+static node_t *create_assignment(node_t *variable, node_t *value) {
+    node_t *assignment = create_node(ASSIGNMENT_STATEMENT, NULL, 2);
+    assignment->children[0] = variable;
+    assignment->children[1] = value;
+    return assignment;
+}
+
+static node_t *create_if(node_t *relation, node_t *then_statement, node_t *else_statement) {
+    node_t *statement = create_node(IF_STATEMENT, NULL, else_statement == NULL ? 2 : 3);
+    statement->children[0] = relation;
+    statement->children[1] = then_statement;
+    if (else_statement != NULL) {
+        statement->children[2] = else_statement;
+    }
+    return statement;
+}
+
+/**Finds the list of statements that make up the body of a loop
+ * @return the list, or NULL if the body is a single statement */
+static node_t *loop_statements(node_t *loop) {
+    node_t *body = loop->children[1];
+    while (body->type == BLOCK && body->n_children > 0) {
+        body = body->children[body->n_children - 1];
+    }
+    return body->type == STATEMENT_LIST ? body : NULL;
+}
+
+static size_t count_assignments(node_t *node, symbol_t *sym) {
+    if (node == NULL) {
+        return 0;
+    }
+
+    size_t count = is_assignment(node) && node->children[0]->entry == sym;
+    for (size_t i = 0; i < node->n_children; i++) {
+        count += count_assignments(node->children[i], sym);
+    }
+    return count;
+}
+
+/**Finds the constant a statement steps a variable by, if it is of the form
+ * i += c, i -= c, i := i + c, i := c + i or i := i - c
+ * @param node the statement
+ * @param sym set to the variable
+ * @param step set to the constant
+ * @return if the statement has one of the forms */
+static bool find_step(node_t *node, symbol_t **sym, int64_t *step) {
+    if (!is_assignment(node)) {
+        return false;
+    }
+
+    *sym = node->children[0]->entry;
+    node_t *value = node->children[1];
+    if ((node->type == ADD_STATEMENT || node->type == SUBTRACT_STATEMENT) && value->type == NUMBER_DATA) {
+        *step = *((int64_t *)value->data);
+        if (node->type == SUBTRACT_STATEMENT) {
+            *step = -(uint64_t)*step;
+        }
+        return true;
+    }
+
+    if (node->type != ASSIGNMENT_STATEMENT || value->type != EXPRESSION || value->data == NULL ||
+        value->n_children != 2) {
+        return false;
+    }
+
+    char op = *((char *)value->data);
+    node_t *left = value->children[0], *right = value->children[1];
+    if (op == '+' && right->type == IDENTIFIER_DATA && right->entry == *sym) {
+        left = value->children[1];
+        right = value->children[0];
+    }
+    if ((op != '+' && op != '-') || left->type != IDENTIFIER_DATA || left->entry != *sym ||
+        right->type != NUMBER_DATA) {
+        return false;
+    }
+
+    *step = *((int64_t *)right->data);
+    if (op == '-') {
+        *step = -(uint64_t)*step;
+    }
+    return true;
+}
+
+/**Checks if a top level statement of a loop body steps a basic induction
+ * variable of the loop
+ * @param loop the WHILE_STATEMENT
+ * @param statement the statement
+ * @param sym set to the variable
+ * @param step set to the constant it is stepped by */
+static bool find_induction_variable(node_t *loop, node_t *statement, symbol_t **sym, int64_t *step) {
+    return find_step(statement, sym, step) && ((*sym)->type == SYM_LOCAL_VAR || (*sym)->type == SYM_PARAMETER) &&
+           count_assignments(loop->children[1], *sym) == 1;
+}
+
+static int polynomial_degree(struct polynomial_t *polynomial) {
+    int degree = MAX_DEGREE;
+    while (degree >= 0 && polynomial->coefficients[degree] == NULL) {
+        degree--;
+    }
+    return degree;
+}
+
+static void destroy_polynomial(struct polynomial_t *polynomial) {
+    for (int i = 0; i <= MAX_DEGREE; i++) {
+        if (polynomial->coefficients[i] != NULL) {
+            destroy_subtree(polynomial->coefficients[i]);
+        }
+    }
+}
+
+/**Adds or subtracts two terms, either of which may be zero, i.e. NULL */
+static node_t *combine_terms(const char *op, node_t *left, node_t *right) {
+    if (right == NULL) {
+        return left;
+    }
+    if (left == NULL) {
+        return *op == '-' ? create_operation(EXPRESSION, "-", right, NULL) : right;
+    }
+    return create_operation(EXPRESSION, op, left, right);
+}
+
+/**Finds the value of an expression in iteration k of a loop, as a polynomial
+ * in k. The iterations are counted from 0 at the entry of the loop
+ * @param node the expression
+ * @param counter the induction variable, which has its value at the entry
+ *                of the loop in the coefficients
+ * @param step the constant the induction variable is stepped by
+ * @param writes the variables written in the loop
+ * @param result set to the polynomial, which owns its coefficients
+ * @return false if the expression is not a polynomial of at most MAX_DEGREE,
+ *         or reads another variable that changes in the loop */
+static bool find_polynomial(node_t *node, symbol_t *counter, int64_t step, struct loop_writes *writes,
+                            struct polynomial_t *result) {
+    *result = (struct polynomial_t){0};
+    switch (node->type) {
+        case NUMBER_DATA:
+            result->coefficients[0] = copy_subtree(node, NULL);
+            return true;
+        case IDENTIFIER_DATA:
+            if (node->entry == counter) {
+                result->coefficients[0] = copy_subtree(node, NULL);
+                result->coefficients[1] = create_number(step);
+                return true;
+            }
+            if (!is_loop_invariant(node, writes)) {
+                return false;
+            }
+            result->coefficients[0] = copy_subtree(node, NULL);
+            return true;
+        case EXPRESSION:
+            if (node->data != NULL) {
+                break;
+            }
+            // Calls are never part of a polynomial
+            return false;
+        default:
+            return false;
+    }
+
+    char *op = node->data;
+    struct polynomial_t left, right;
+    if (!find_polynomial(node->children[0], counter, step, writes, &left)) {
+        return false;
+    }
+
+    if (node->n_children == 1) {
+        if (*op != '-' && polynomial_degree(&left) > 0) {
+            destroy_polynomial(&left);
+            return false;
+        }
+        for (int i = 0; i <= MAX_DEGREE; i++) {
+            if (left.coefficients[i] != NULL) {
+                result->coefficients[i] = create_operation(EXPRESSION, op, left.coefficients[i], NULL);
+            }
+        }
+        return true;
+    }
+
+    if (!find_polynomial(node->children[1], counter, step, writes, &right)) {
+        destroy_polynomial(&left);
+        return false;
+    }
+
+    switch (*op) {
+        case '+':
+        case '-':
+            for (int i = 0; i <= MAX_DEGREE; i++) {
+                result->coefficients[i] = combine_terms(op, left.coefficients[i], right.coefficients[i]);
+            }
+            return true;
+        case '*':
+            if (polynomial_degree(&left) + polynomial_degree(&right) > MAX_DEGREE) {
+                break;
+            }
+            for (int i = 0; i <= MAX_DEGREE; i++) {
+                for (int j = 0; i + j <= MAX_DEGREE; j++) {
+                    if (left.coefficients[i] == NULL || right.coefficients[j] == NULL) {
+                        continue;
+                    }
+                    node_t *term = create_operation(EXPRESSION, "*", copy_subtree(left.coefficients[i], NULL),
+                                                    copy_subtree(right.coefficients[j], NULL));
+                    result->coefficients[i + j] = combine_terms("+", result->coefficients[i + j], term);
+                }
+            }
+            destroy_polynomial(&left);
+            destroy_polynomial(&right);
+            return true;
+        default:
+            // The other operators are only applied to invariant operands
+            if (polynomial_degree(&left) > 0 || polynomial_degree(&right) > 0) {
+                break;
+            }
+            result->coefficients[0] = create_operation(EXPRESSION, op, left.coefficients[0], right.coefficients[0]);
+            return true;
+    }
+
+    destroy_polynomial(&left);
+    destroy_polynomial(&right);
+    return false;
+}
+
+/**Finds the amount a statement adds to a variable that is only accumulated
+ * in a loop, if it is of the form s += e, s -= e, s := s + e, s := e + s or
+ * s := s - e, where e does not depend on s
+ * @param node the statement
+ * @param sym set to the variable
+ * @param op set to "+" or "-"
+ * @return the expression e, or NULL if the statement has none of the forms */
+static node_t *find_accumulation(node_t *node, symbol_t **sym, const char **op) {
+    if (node->type != ASSIGNMENT_STATEMENT && node->type != ADD_STATEMENT && node->type != SUBTRACT_STATEMENT) {
+        return NULL;
+    }
+
+    *sym = node->children[0]->entry;
+    node_t *value = node->children[1];
+    if (node->type != ASSIGNMENT_STATEMENT) {
+        *op = node->type == ADD_STATEMENT ? "+" : "-";
+        return value;
+    }
+
+    if (value->type != EXPRESSION || value->data == NULL || value->n_children != 2) {
+        return NULL;
+    }
+    *op = value->data;
+    node_t *left = value->children[0], *right = value->children[1];
+    if (**op == '+' && right->type == IDENTIFIER_DATA && right->entry == *sym) {
+        return left;
+    }
+    if ((**op == '+' || **op == '-') && left->type == IDENTIFIER_DATA && left->entry == *sym) {
+        return right;
+    }
+    return NULL;
+}
+
+/**Creates the statement dividing one of two variables by a constant, the
+ * first one if it is a multiple of it and otherwise the second one
+ * @param first the first variable
+ * @param second the second variable, or the statement to run instead
+ * @param divisor the constant */
+static node_t *create_exact_division(symbol_t *first, node_t *second, int64_t divisor) {
+    node_t *multiple = create_operation(
+        EXPRESSION, "*", create_operation(EXPRESSION, "/", create_identifier(first), create_number(divisor)),
+        create_number(divisor));
+    node_t *halved = create_assignment(
+        create_identifier(first),
+        create_operation(EXPRESSION, "/", create_identifier(first), create_number(divisor)));
+    if (second->type == IDENTIFIER_DATA) {
+        second = create_assignment(second, create_operation(EXPRESSION, "/", create_identifier(second->entry),
+                                                              create_number(divisor)));
+    }
+    return create_if(create_operation(RELATION, "=", multiple, create_identifier(first)), halved, second);
+}
+
+/**Creates the statements computing the sum of k^degree for k from 0 to n - 1,
+ * i.e. n(n - 1)/2 for degree 1 and (n - 1)n(2n - 1)/6 for degree 2. The
+ * divisions are done on the factors they divide exactly before multiplying,
+ * so the sum is exact modulo 2^64 like the additions of the loop are
+ * @param function symbol table entry of the function
+ * @param count the number of terms n, which is positive
+ * @param degree 1 or 2
+ * @param statements list the statements are appended to
+ * @return the variable holding the sum */
+static symbol_t *create_power_sum(symbol_t *function, symbol_t *count, int degree, node_t *statements) {
+    node_t *factors[3];
+    factors[0] = create_temporary(function, SCEV_PREFIX);
+    factors[1] = create_temporary(function, SCEV_PREFIX);
+    node_t *sum = create_temporary(function, SCEV_PREFIX);
+    symbol_t *a = factors[0]->entry, *b = factors[1]->entry, *c = NULL;
+
+    node_t *added[6];
+    size_t n_added = 0;
+    added[n_added++] = create_assignment(
+        factors[0], create_operation(EXPRESSION, "-", create_identifier(count), create_number(1)));
+    added[n_added++] = create_assignment(factors[1], create_identifier(count));
+    added[n_added++] = create_exact_division(a, create_identifier(b), 2);
+    if (degree == 2) {
+        // One of n - 1, n and 2n - 1 is a multiple of 3. 2n - 1 may not fit,
+        // but then (2n - 1)/3 = 2(n - 2)/3 + 1 where n - 2 is a multiple of 3
+        factors[2] = create_temporary(function, SCEV_PREFIX);
+        c = factors[2]->entry;
+        added[n_added++] = create_assignment(
+            factors[2], create_operation(EXPRESSION, "-",
+                                         create_operation(EXPRESSION, "*", create_number(2), create_identifier(count)),
+                                         create_number(1)));
+        node_t *third = create_assignment(
+            create_identifier(c),
+            create_operation(
+                EXPRESSION, "+",
+                create_operation(EXPRESSION, "*",
+                                 create_operation(EXPRESSION, "/",
+                                                  create_operation(EXPRESSION, "-", create_identifier(count),
+                                                                   create_number(2)),
+                                                  create_number(3)),
+                                 create_number(2)),
+                create_number(1)));
+        added[n_added++] = create_exact_division(a, create_exact_division(b, third, 3), 3);
+    }
+
+    node_t *product = create_operation(EXPRESSION, "*", create_identifier(a), create_identifier(b));
+    if (c != NULL) {
+        product = create_operation(EXPRESSION, "*", product, create_identifier(c));
+    }
+    added[n_added++] = create_assignment(sum, product);
+
+    statements->children = realloc(statements->children, (statements->n_children + n_added) * sizeof(node_t *));
+    for (size_t i = 0; i < n_added; i++) {
+        statements->children[statements->n_children++] = added[i];
+    }
+    return sum->entry;
+}
+
+/**Builds the closed form of a counted loop that does nothing but accumulate
+ * polynomials of its counter into variables, see replace_by_closed_form
+ * @param function symbol table entry of the function
+ * @param loop the WHILE_STATEMENT
+ * @param writes the variables written in the loop
+ * @return the statements replacing the loop, or NULL if it has another form */
+static node_t *create_closed_form(symbol_t *function, node_t *loop, struct loop_writes *writes) {
+    node_t *relation = loop->children[0];
+    node_t *list = loop_statements(loop);
+    char relation_type = *((char *)relation->data);
+    if (writes->has_call || relation_type == '=' || list == NULL || list->n_children == 0) {
+        return NULL;
+    }
+
+    // The counter is stepped by one towards a bound that doesn't change
+    node_t *counter = relation->children[0], *bound = relation->children[1];
+    if (counter->type != IDENTIFIER_DATA || is_loop_invariant(counter, writes)) {
+        counter = relation->children[1];
+        bound = relation->children[0];
+        relation_type = relation_type == '<' ? '>' : '<';
+    }
+    if (counter->type != IDENTIFIER_DATA || (bound->type != IDENTIFIER_DATA && bound->type != NUMBER_DATA) ||
+        !is_loop_invariant(bound, writes)) {
+        return NULL;
+    }
+
+    symbol_t *sym;
+    int64_t step;
+    if (!find_induction_variable(loop, list->children[list->n_children - 1], &sym, &step) ||
+        sym != counter->entry || step != (relation_type == '<' ? 1 : -1)) {
+        return NULL;
+    }
+
+    // Everything before the step accumulates a polynomial of the counter
+    size_t n_sums = list->n_children - 1;
+    struct polynomial_t sums[n_sums + 1];
+    int degree = 0;
+    for (size_t i = 0; i < n_sums; i++) {
+        symbol_t *accumulator;
+        const char *op;
+        node_t *term = find_accumulation(list->children[i], &accumulator, &op);
+        if (term == NULL || accumulator == sym ||
+            !find_polynomial(term, sym, step, writes, &sums[i])) {
+            for (size_t j = 0; j < i; j++) {
+                destroy_polynomial(&sums[j]);
+            }
+            return NULL;
+        }
+        if (polynomial_degree(&sums[i]) > degree) {
+            degree = polynomial_degree(&sums[i]);
+        }
+    }
+
+    // The number of iterations. When the loop runs at all it is between 1 and
+    // 2^64 - 1, and the wrapped difference is only positive below 2^63, so the
+    // loop is kept for the longer runs
+    node_t *count = create_temporary(function, SCEV_PREFIX);
+    symbol_t *count_sym = count->entry;
+    node_t *distance = relation_type == '<'
+                           ? create_operation(EXPRESSION, "-", copy_subtree(bound, NULL), create_identifier(sym))
+                           : create_operation(EXPRESSION, "-", create_identifier(sym), copy_subtree(bound, NULL));
+    node_t *statements = create_node(STATEMENT_LIST, NULL, 0);
+    symbol_t *power_sums[MAX_DEGREE + 1] = {count_sym};
+    for (int i = 1; i <= degree; i++) {
+        power_sums[i] = create_power_sum(function, count_sym, i, statements);
+    }
+
+    // The sum of c_0 + c_1 k + c_2 k^2 over all iterations is
+    // c_0 n + c_1 (sum of k) + c_2 (sum of k^2)
+    for (size_t i = 0; i < n_sums; i++) {
+        symbol_t *accumulator;
+        const char *op;
+        find_accumulation(list->children[i], &accumulator, &op);
+
+        node_t *total = NULL;
+        for (int j = 0; j <= MAX_DEGREE; j++) {
+            if (sums[i].coefficients[j] != NULL) {
+                node_t *term = create_operation(EXPRESSION, "*", sums[i].coefficients[j],
+                                                create_identifier(power_sums[j]));
+                total = combine_terms("+", total, term);
+            }
+        }
+        node_t *value = create_operation(EXPRESSION, op, create_identifier(accumulator), total);
+        fold_subtree(&value);
+
+        statements->children = realloc(statements->children, (statements->n_children + 1) * sizeof(node_t *));
+        statements->children[statements->n_children++] = create_assignment(create_identifier(accumulator), value);
+    }
+
+    statements->children = realloc(statements->children, (statements->n_children + 1) * sizeof(node_t *));
+    statements->children[statements->n_children++] =
+        create_assignment(create_identifier(sym), copy_subtree(bound, NULL));
+
+    node_t *runs = create_node(STATEMENT_LIST, NULL, 2);
+    runs->children[0] = create_assignment(count, distance);
+    runs->children[1] =
+        create_if(create_operation(RELATION, ">", create_identifier(count_sym), create_number(0)), statements, loop);
+    node_t *first_test = create_operation(RELATION, relation_type == '<' ? "<" : ">", create_identifier(sym),
+                                          copy_subtree(bound, NULL));
+    return create_if(first_test, runs, NULL);
+}
+
+bool replace_by_closed_form(symbol_t *function, node_t **slot) {
+    struct loop_writes writes = {.has_call = false};
+    tlhash_init(&writes.written, 32);
+    find_loop_writes(*slot, &writes);
+
+    node_t *replacement = create_closed_form(function, *slot, &writes);
+    tlhash_finalize(&writes.written);
+    if (replacement == NULL) {
+        return false;
+    }
+
+    *slot = replacement;
+    return true;
+}
+
+/**Finds the other factor of a product of a variable
+ * @param node the expression
+ * @param sym the variable
+ * @return the factor if it is a variable or a constant, otherwise NULL */
+static node_t *product_factor(node_t *node, symbol_t *sym) {
+    if (node->type != EXPRESSION || node->data == NULL || strcmp(node->data, "*") || node->n_children != 2) {
+        return NULL;
+    }
+
+    node_t *variable = node->children[0], *factor = node->children[1];
+    if (factor->type == IDENTIFIER_DATA && factor->entry == sym) {
+        variable = node->children[1];
+        factor = node->children[0];
+    }
+    if (variable->type != IDENTIFIER_DATA || variable->entry != sym ||
+        (factor->type != NUMBER_DATA && factor->type != IDENTIFIER_DATA)) {
+        return NULL;
+    }
+    return factor;
+}
+
+static size_t count_products(node_t *node, symbol_t *sym, node_t *factor) {
+    if (node == NULL) {
+        return 0;
+    }
+
+    node_t *other = product_factor(node, sym);
+    size_t count = other != NULL && same_expression(other, factor);
+    for (size_t i = 0; i < node->n_children; i++) {
+        count += count_products(node->children[i], sym, factor);
+    }
+    return count;
+}
+
+/**Replaces the products of an induction variable and invariant factors in a
+ * subtree by temporaries
+ * @param loop the WHILE_STATEMENT
+ * @param slot the child pointer holding the subtree
+ * @param sym the induction variable
+ * @param writes the variables written in the loop
+ * @param reduced the products replaced so far, which the new ones are added to
+ * @param first the first product of this induction variable in reduced */
+static void replace_products(symbol_t *function, node_t *loop, node_t **slot, symbol_t *sym,
+                             struct loop_writes *writes, struct reduction_list *reduced, size_t first) {
+    node_t *node = *slot;
+    if (node == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < node->n_children; i++) {
+        replace_products(function, loop, &node->children[i], sym, writes, reduced, first);
+    }
+
+    node_t *factor = product_factor(node, sym);
+    if (factor == NULL || !is_loop_invariant(factor, writes)) {
+        return;
+    }
+
+    // Products with the same factor share a temporary
+    node_t *initialization = NULL;
+    for (size_t i = first; i < reduced->count; i++) {
+        if (same_expression(reduced->initializations[i]->children[1]->children[1], factor)) {
+            initialization = reduced->initializations[i];
+        }
+    }
+
+    if (initialization == NULL) {
+        // Variables live in the stack frame, so keeping the temporary there
+        // and stepping it costs about as much as a single multiplication.
+        // It only pays off when it replaces more than one
+        if (count_products(loop, sym, factor) < 2) {
+            return;
+        }
+
+        if (reduced->count == reduced->capacity) {
+            reduced->capacity = reduced->capacity == 0 ? 4 : reduced->capacity * 2;
+            reduced->initializations =
+                realloc(reduced->initializations, reduced->capacity * sizeof(node_t *));
+        }
+        initialization = create_assignment(
+            create_temporary(function, SCEV_PREFIX),
+            create_operation(EXPRESSION, "*", create_identifier(sym), copy_subtree(factor, NULL)));
+        reduced->initializations[reduced->count++] = initialization;
+    }
+
+    *slot = create_identifier(initialization->children[0]->entry);
+    destroy_subtree(node);
+}
+
+node_t **reduce_strength(symbol_t *function, node_t **slot) {
+    node_t *loop = *slot;
+    node_t *list = loop_statements(loop);
+    if (list == NULL) {
+        return slot;
+    }
+
+    struct loop_writes writes = {.has_call = false};
+    tlhash_init(&writes.written, 32);
+    find_loop_writes(loop, &writes);
+
+    struct reduction_list reduced = {0};
+    for (size_t i = 0; i < list->n_children; i++) {
+        symbol_t *sym;
+        int64_t step;
+        if (!find_induction_variable(loop, list->children[i], &sym, &step)) {
+            continue;
+        }
+
+        size_t first = reduced.count;
+        replace_products(function, loop, &loop->children[0], sym, &writes, &reduced, first);
+        replace_products(function, loop, &loop->children[1], sym, &writes, &reduced, first);
+        size_t n_updates = reduced.count - first;
+        if (n_updates == 0) {
+            continue;
+        }
+
+        // The temporaries are stepped right in front of the variable, so
+        // that they match it everywhere else in the loop
+        list->children = realloc(list->children, (list->n_children + n_updates) * sizeof(node_t *));
+        memmove(&list->children[i + n_updates], &list->children[i], (list->n_children - i) * sizeof(node_t *));
+        list->n_children += n_updates;
+        for (size_t j = 0; j < n_updates; j++) {
+            node_t *temporary = reduced.initializations[first + j]->children[0];
+            node_t *factor = reduced.initializations[first + j]->children[1]->children[1];
+            node_t *increment = create_operation(EXPRESSION, "*", copy_subtree(factor, NULL), create_number(step));
+            fold_subtree(&increment);
+            list->children[i + j] = create_assignment(
+                create_identifier(temporary->entry),
+                create_operation(EXPRESSION, "+", create_identifier(temporary->entry), increment));
+        }
+        i += n_updates;
+    }
+
+    tlhash_finalize(&writes.written);
+    if (reduced.count == 0) {
+        return slot;
+    }
+
+    node_t *preheader = create_node(STATEMENT_LIST, NULL, reduced.count + 1);
+    for (size_t i = 0; i < reduced.count; i++) {
+        preheader->children[i] = reduced.initializations[i];
+    }
+    preheader->children[reduced.count] = loop;
+    *slot = preheader;
+    free(reduced.initializations);
+    return &preheader->children[reduced.count];
+}
@@ -0,0 +1,702 @@
+#include <vslc.h>
+
+// Set by the -fpeephole flag, defined in vslc.c
+extern bool peephole;
+// Set by the -fsimplify-cfg flag, defined in vslc.c
+extern bool simplify_cfg;
+
+// The kinds of lines in the generated assembly
+enum line_kind_t {
+    LINE_INSTRUCTION,
+    LINE_LABEL,
+    LINE_DIRECTIVE,
+    LINE_COMMENT
+};
+
+#define MAX_OPERANDS 3
+
+// A line of the generated assembly of a function, split into its parts so
+// the instructions can be rewritten
+struct line_t {
+    enum line_kind_t kind;
+    // The whole line for anything but instructions, which are reformatted
+    // when printed
+    char *text;
+    char *mnemonic;
+    char *operands[MAX_OPERANDS];
+    size_t n_operands;
+    bool deleted;
+};
+
+// The general purpose registers, with the names of their lower 32, 16 and
+// 8 bits. Writing to any of them changes the whole register as far as we
+// are concerned
+static const char *REGISTERS[][4] = {
+    {"%rax", "%eax", "%ax", "%al"},
+    {"%rbx", "%ebx", "%bx", "%bl"},
+    {"%rcx", "%ecx", "%cx", "%cl"},
+    {"%rdx", "%edx", "%dx", "%dl"},
+    {"%rsi", "%esi", "%si", "%sil"},
+    {"%rdi", "%edi", "%di", "%dil"},
+    {"%rbp", "%ebp", "%bp", "%bpl"},
+    {"%rsp", "%esp", "%sp", "%spl"},
+    {"%r8", "%r8d", "%r8w", "%r8b"},
+    {"%r9", "%r9d", "%r9w", "%r9b"},
+    {"%r10", "%r10d", "%r10w", "%r10b"},
+    {"%r11", "%r11d", "%r11w", "%r11b"},
+    {"%r12", "%r12d", "%r12w", "%r12b"},
+    {"%r13", "%r13d", "%r13w", "%r13b"},
+    {"%r14", "%r14d", "%r14w", "%r14b"},
+    {"%r15", "%r15d", "%r15w", "%r15b"}};
+#define N_REGISTERS 16
+#define RAX 0
+#define RDX 3
+#define RBP 6
+#define RSP 7
+
+// What memory an operand refers to
+enum memory_kind_t {
+    NOT_MEMORY,
+    // A slot in the frame, addressed directly relative to %rbp or %rsp
+    MEMORY_STACK,
+    // A global variable, addressed by its label
+    MEMORY_GLOBAL,
+    // Anything else, which may alias any other memory
+    MEMORY_UNKNOWN
+};
+
+// What we need to know about an instruction to track the registers it uses
+struct instruction_info_t {
+    const char *mnemonic;
+    // The last operand is written to
+    bool writes_destination;
+    // The last operand is read as well, which is not the case for moves
+    bool reads_destination;
+    // Registers that are written without being an operand, as a bit set
+    unsigned int implicit_writes;
+};
+
+static const struct instruction_info_t INSTRUCTIONS[] = {
+    {"movq", true, false, 0},
+    {"addq", true, true, 0},
+    {"subq", true, true, 0},
+    {"andq", true, true, 0},
+    {"orq", true, true, 0},
+    {"xorq", true, true, 0},
+    {"xorl", true, true, 0},
+    {"shrq", true, true, 0},
+    {"negq", true, true, 0},
+    {"notq", true, true, 0},
+    {"cmpq", false, false, 0},
+    {"testq", false, false, 0},
+    {"cmove", true, true, 0},
+    {"cmovg", true, true, 0},
+    {"cmovl", true, true, 0},
+    {"cqto", false, false, 1 << RDX},
+    {"idivq", false, false, 1 << RAX | 1 << RDX},
+    {"divl", false, false, 1 << RAX | 1 << RDX}};
+
+// What is known at a point in a straight line of instructions
+struct register_state_t {
+    // The memory operand each register holds the value of, if any
+    char *holds[N_REGISTERS];
+    // Stores that have not been read yet, by their line index
+    size_t *pending;
+    size_t n_pending;
+};
+
+/**Drops stores that are overwritten before being read, and loads of values
+ * that are already in a register, within straight lines of instructions
+ * @param lines the lines of a function
+ * @param n_lines the number of lines */
+static void forward_stores(struct line_t *lines, size_t n_lines);
+/**Removes jumps to jumps, jumps to the next line, unreachable code and labels
+ * nothing jumps to, and inverts conditional jumps over unconditional ones
+ * @param lines the lines of a function
+ * @param n_lines the number of lines */
+static void simplify_control_flow(struct line_t *lines, size_t n_lines);
+
+static struct line_t *parse_lines(char *text, size_t *n_lines) {
+    size_t capacity = 64;
+    struct line_t *lines = malloc(capacity * sizeof(struct line_t));
+    *n_lines = 0;
+
+    char *save;
+    for (char *text_line = strtok_r(text, "\n", &save); text_line != NULL; text_line = strtok_r(NULL, "\n", &save)) {
+        char *start = text_line + strspn(text_line, " \t");
+        size_t length = strlen(start);
+        if (length == 0) {
+            continue;
+        }
+
+        if (*n_lines == capacity) {
+            capacity *= 2;
+            lines = realloc(lines, capacity * sizeof(struct line_t));
+        }
+
+        struct line_t *line = &lines[(*n_lines)++];
+        *line = (struct line_t){.text = strdup(text_line), .n_operands = 0, .deleted = false};
+
+        if (start[length - 1] == ':') {
+            line->kind = LINE_LABEL;
+            line->mnemonic = strndup(start, length - 1);
+            continue;
+        }
+
+        if (*start == '#' || *start == '.') {
+            line->kind = *start == '#' ? LINE_COMMENT : LINE_DIRECTIVE;
+            line->mnemonic = strdup(start);
+            continue;
+        }
+
+        line->kind = LINE_INSTRUCTION;
+        size_t mnemonic_length = strcspn(start, " \t");
+        line->mnemonic = strndup(start, mnemonic_length);
+
+        // Operands are separated by commas, except for the ones inside
+        // the parentheses of memory operands
+        char *operand = start + mnemonic_length;
+        while (*operand != '\0' && line->n_operands < MAX_OPERANDS) {
+            operand += strspn(operand, " \t");
+            size_t operand_length = 0;
+            int depth = 0;
+            while (operand[operand_length] != '\0' && (operand[operand_length] != ',' || depth > 0)) {
+                depth += operand[operand_length] == '(';
+                depth -= operand[operand_length] == ')';
+                operand_length++;
+            }
+
+            size_t trimmed_length = operand_length;
+            while (trimmed_length > 0 && strchr(" \t", operand[trimmed_length - 1]) != NULL) {
+                trimmed_length--;
+            }
+            if (trimmed_length > 0) {
+                line->operands[line->n_operands++] = strndup(operand, trimmed_length);
+            }
+
+            operand += operand_length;
+            if (*operand == ',') {
+                operand++;
+            }
+        }
+    }
+
+    return lines;
+}
+
+static void print_line(struct line_t *line) {
+    if (line->kind != LINE_INSTRUCTION) {
+        puts(line->text);
+        return;
+    }
+
+    printf("\t%s", line->mnemonic);
+    for (size_t i = 0; i < line->n_operands; i++) {
+        printf("%s%s", i == 0 ? " " : ", ", line->operands[i]);
+    }
+    putchar('\n');
+}
+
+static void destroy_line(struct line_t *line) {
+    free(line->text);
+    free(line->mnemonic);
+    for (size_t i = 0; i < line->n_operands; i++) {
+        free(line->operands[i]);
+    }
+}
+
+void optimize_function_assembly(char *text) {
+    size_t n_lines;
+    struct line_t *lines = parse_lines(text, &n_lines);
+
+    // Blocks merged by simplifying the control flow give longer straight
+    // lines of instructions to forward stores in
+    if (simplify_cfg) {
+        simplify_control_flow(lines, n_lines);
+    }
+    if (peephole) {
+        forward_stores(lines, n_lines);
+    }
+
+    for (size_t i = 0; i < n_lines; i++) {
+        if (!lines[i].deleted) {
+            print_line(&lines[i]);
+        }
+        destroy_line(&lines[i]);
+    }
+    free(lines);
+}
+
+static int register_index(const char *operand) {
+    for (int r = 0; r < N_REGISTERS; r++) {
+        for (int part = 0; part < 4; part++) {
+            if (!strcmp(operand, REGISTERS[r][part])) {
+                return r;
+            }
+        }
+    }
+    return -1;
+}
+
+static enum memory_kind_t memory_kind(const char *operand) {
+    if (operand[0] == '$' || operand[0] == '%') {
+        return NOT_MEMORY;
+    }
+
+    const char *address = strchr(operand, '(');
+    if (address == NULL) {
+        return MEMORY_GLOBAL;
+    }
+
+    if (!strcmp(address, "(%rbp)") || !strcmp(address, "(%rsp)")) {
+        return MEMORY_STACK;
+    }
+    return MEMORY_UNKNOWN;
+}
+
+static const struct instruction_info_t *find_instruction_info(struct line_t *line) {
+    // With one operand, imulq multiplies into %rdx:%rax
+    static const struct instruction_info_t WIDENING_MULTIPLY = {"imulq", false, false, 1 << RAX | 1 << RDX};
+    static const struct instruction_info_t MULTIPLY = {"imulq", true, true, 0};
+    if (!strcmp(line->mnemonic, "imulq")) {
+        return line->n_operands == 1 ? &WIDENING_MULTIPLY : &MULTIPLY;
+    }
+
+    size_t n_instructions = sizeof(INSTRUCTIONS) / sizeof(INSTRUCTIONS[0]);
+    for (size_t i = 0; i < n_instructions; i++) {
+        if (!strcmp(line->mnemonic, INSTRUCTIONS[i].mnemonic)) {
+            return &INSTRUCTIONS[i];
+        }
+    }
+    return NULL;
+}
+
+static void forget_register(struct register_state_t *state, int r) {
+    free(state->holds[r]);
+    state->holds[r] = NULL;
+}
+
+static void forget_registers(struct register_state_t *state) {
+    for (int r = 0; r < N_REGISTERS; r++) {
+        forget_register(state, r);
+    }
+}
+
+static void forget_memory(struct register_state_t *state, const char *memory) {
+    for (int r = 0; r < N_REGISTERS; r++) {
+        if (state->holds[r] != NULL && !strcmp(state->holds[r], memory)) {
+            forget_register(state, r);
+        }
+    }
+}
+
+static void set_holds(struct register_state_t *state, int r, const char *memory) {
+    forget_register(state, r);
+    state->holds[r] = strdup(memory);
+}
+
+static const char *last_operand(struct line_t *line) {
+    return line->operands[line->n_operands - 1];
+}
+
+/**Removes the pending stores to an operand, which has been read
+ * @return the line index of the removed store, or SIZE_MAX if there was none */
+static size_t take_pending_store(struct register_state_t *state, struct line_t *lines, const char *memory) {
+    for (size_t i = 0; i < state->n_pending; i++) {
+        size_t store = state->pending[i];
+        if (!strcmp(last_operand(&lines[store]), memory)) {
+            state->pending[i] = state->pending[--state->n_pending];
+            return store;
+        }
+    }
+    return SIZE_MAX;
+}
+
+static void replace_operand(struct line_t *line, size_t k, const char *operand) {
+    free(line->operands[k]);
+    line->operands[k] = strdup(operand);
+}
+
+void forward_stores(struct line_t *lines, size_t n_lines) {
+    struct register_state_t state = {.holds = {NULL}, .pending = malloc(n_lines * sizeof(size_t)), .n_pending = 0};
+
+    // Set after the frame is taken down. Until the return, the stores still
+    // pending are to a frame that is about to disappear
+    bool in_epilogue = false;
+
+    for (size_t i = 0; i < n_lines; i++) {
+        struct line_t *line = &lines[i];
+        if (line->kind == LINE_COMMENT || (line->kind == LINE_DIRECTIVE && !strncmp(line->mnemonic, ".p2align", 8))) {
+            continue;
+        }
+
+        // Other code may jump to a label, and we don't know what happens
+        // around directives
+        if (line->kind != LINE_INSTRUCTION) {
+            forget_registers(&state);
+            state.n_pending = 0;
+            continue;
+        }
+
+        char *mnemonic = line->mnemonic;
+
+        if (!strcmp(mnemonic, "ret")) {
+            // Nothing can read the frame of a function that has returned
+            for (size_t p = 0; p < state.n_pending; p++) {
+                size_t store = state.pending[p];
+                if (memory_kind(last_operand(&lines[store])) == MEMORY_STACK) {
+                    lines[store].deleted = true;
+                }
+            }
+            forget_registers(&state);
+            state.n_pending = 0;
+            in_epilogue = false;
+            continue;
+        }
+
+        bool takes_down_frame =
+            !strcmp(mnemonic, "leave") ||
+            (!strcmp(mnemonic, "addq") && line->n_operands == 2 && !strcmp(line->operands[1], "%rsp"));
+        if (takes_down_frame) {
+            forget_registers(&state);
+            in_epilogue = true;
+            continue;
+        }
+
+        if (in_epilogue) {
+            state.n_pending = 0;
+            in_epilogue = false;
+        }
+
+        // A conditional jump continues in a straight line when not taken, but
+        // the code it jumps to may read any of the pending stores
+        if (mnemonic[0] == 'j') {
+            state.n_pending = 0;
+            if (!strcmp(mnemonic, "jmp")) {
+                forget_registers(&state);
+            }
+            continue;
+        }
+
+        // Calls overwrite the registers, and may read and write the globals
+        // and the arguments passed on the stack
+        const struct instruction_info_t *info = find_instruction_info(line);
+        if (info == NULL || (line->n_operands == 0 && info->implicit_writes == 0)) {
+            forget_registers(&state);
+            state.n_pending = 0;
+            continue;
+        }
+
+        size_t last = line->n_operands - 1;
+        if (line->n_operands != 0 && info->writes_destination) {
+            int destination = register_index(line->operands[last]);
+            if (destination == RBP || destination == RSP) {
+                forget_registers(&state);
+                state.n_pending = 0;
+                continue;
+            }
+        }
+
+        // Read values already in a register from the register instead
+        for (size_t k = 0; k < line->n_operands; k++) {
+            if (k == last && info->writes_destination) {
+                continue;
+            }
+
+            enum memory_kind_t kind = memory_kind(line->operands[k]);
+            if (kind != MEMORY_STACK && kind != MEMORY_GLOBAL) {
+                continue;
+            }
+
+            for (int r = 0; r < N_REGISTERS; r++) {
+                if (state.holds[r] != NULL && !strcmp(state.holds[r], line->operands[k])) {
+                    replace_operand(line, k, REGISTERS[r][0]);
+                    break;
+                }
+            }
+        }
+
+        bool is_move = !strcmp(mnemonic, "movq");
+        int source = is_move ? register_index(line->operands[0]) : -1;
+        int destination = line->n_operands == 0 ? -1 : register_index(line->operands[last]);
+
+        // Moving a register to itself
+        if (is_move && source != -1 && source == destination) {
+            line->deleted = true;
+            continue;
+        }
+
+        // Memory that is read stops any pending store to it from being dropped
+        for (size_t k = 0; k < line->n_operands; k++) {
+            if (k == last && info->writes_destination && !info->reads_destination) {
+                continue;
+            }
+
+            switch (memory_kind(line->operands[k])) {
+                case MEMORY_UNKNOWN:
+                    state.n_pending = 0;
+                    break;
+                case MEMORY_STACK:
+                case MEMORY_GLOBAL:
+                    take_pending_store(&state, lines, line->operands[k]);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        if (line->n_operands != 0 && info->writes_destination) {
+            const char *written = line->operands[last];
+            enum memory_kind_t kind = memory_kind(written);
+
+            if (kind == MEMORY_UNKNOWN) {
+                forget_registers(&state);
+                state.n_pending = 0;
+            } else if (kind != NOT_MEMORY) {
+                // Storing a value that is already there
+                if (source != -1 && state.holds[source] != NULL && !strcmp(state.holds[source], written)) {
+                    line->deleted = true;
+                    continue;
+                }
+
+                // The earlier store is overwritten before anything read it
+                if (is_move) {
+                    size_t store = take_pending_store(&state, lines, written);
+                    if (store != SIZE_MAX) {
+                        lines[store].deleted = true;
+                    }
+                    state.pending[state.n_pending++] = i;
+                }
+
+                forget_memory(&state, written);
+            }
+        }
+
+        if (destination != -1 && info->writes_destination) {
+            forget_register(&state, destination);
+        }
+        for (int r = 0; r < N_REGISTERS; r++) {
+            if (info->implicit_writes & (1 << r)) {
+                forget_register(&state, r);
+            }
+        }
+
+        // What the registers hold after a move
+        if (is_move) {
+            enum memory_kind_t source_kind = memory_kind(line->operands[0]);
+            enum memory_kind_t destination_kind = memory_kind(line->operands[1]);
+
+            if (source != -1 && (destination_kind == MEMORY_STACK || destination_kind == MEMORY_GLOBAL)) {
+                set_holds(&state, source, line->operands[1]);
+            } else if (destination != -1 && (source_kind == MEMORY_STACK || source_kind == MEMORY_GLOBAL)) {
+                set_holds(&state, destination, line->operands[0]);
+            } else if (destination != -1 && source != -1 && state.holds[source] != NULL) {
+                set_holds(&state, destination, state.holds[source]);
+            }
+        }
+    }
+
+    forget_registers(&state);
+    free(state.pending);
+}
+
+/**Finds the line after another one, skipping the lines that don't end up
+ * as anything in the program
+ * @return index of the next line, or n_lines if there is none */
+static size_t next_line(struct line_t *lines, size_t n_lines, size_t i) {
+    for (i++; i < n_lines; i++) {
+        struct line_t *line = &lines[i];
+        bool is_alignment = line->kind == LINE_DIRECTIVE && !strncmp(line->mnemonic, ".p2align", 8);
+        if (!line->deleted && line->kind != LINE_COMMENT && !is_alignment) {
+            break;
+        }
+    }
+    return i;
+}
+
+static bool is_jump(struct line_t *line) {
+    return line->kind == LINE_INSTRUCTION && line->mnemonic[0] == 'j' && line->n_operands == 1;
+}
+
+static bool is_unconditional_jump(struct line_t *line) {
+    return is_jump(line) && !strcmp(line->mnemonic, "jmp");
+}
+
+static bool ends_block(struct line_t *line) {
+    return is_unconditional_jump(line) || (line->kind == LINE_INSTRUCTION && !strcmp(line->mnemonic, "ret"));
+}
+
+/**Checks if a label is among the labels starting at a line
+ * @param i index of the first line to check */
+static bool is_label_at(struct line_t *lines, size_t n_lines, size_t i, const char *label) {
+    for (; i < n_lines && lines[i].kind == LINE_LABEL; i = next_line(lines, n_lines, i)) {
+        if (!strcmp(lines[i].mnemonic, label)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**Finds the first line of code that runs after jumping to a label
+ * @return index of the line, or n_lines if the label is not in the function */
+static size_t code_at_label(struct line_t *lines, size_t n_lines, tlhash_t *labels, const char *label) {
+    struct line_t *label_line;
+    if (tlhash_lookup(labels, (void *)label, strlen(label), (void **)&label_line) != TLHASH_SUCCESS) {
+        return n_lines;
+    }
+
+    size_t i = label_line - lines;
+    while (i < n_lines && lines[i].kind == LINE_LABEL) {
+        i = next_line(lines, n_lines, i);
+    }
+    return i;
+}
+
+static void invert_jump(struct line_t *line) {
+    char *inverted = malloc(strlen(line->mnemonic) + 2);
+    if (line->mnemonic[1] == 'n') {
+        sprintf(inverted, "j%s", line->mnemonic + 2);
+    } else {
+        sprintf(inverted, "jn%s", line->mnemonic + 1);
+    }
+    free(line->mnemonic);
+    line->mnemonic = inverted;
+}
+
+/**Moves the code placed in other sections to the end of the function, each
+ * part on its own, so that falling through from a line to the next always
+ * stays within the same section
+ * @param lines the lines of a function, which are reordered */
+static void separate_sections(struct line_t *lines, size_t n_lines) {
+    size_t *part = malloc(n_lines * sizeof(size_t));
+    size_t *open_parts = malloc((n_lines + 1) * sizeof(size_t));
+    size_t n_parts = 1, depth = 0;
+    open_parts[0] = 0;
+
+    for (size_t i = 0; i < n_lines; i++) {
+        struct line_t *line = &lines[i];
+        if (line->kind == LINE_DIRECTIVE && !strncmp(line->mnemonic, ".pushsection", 12)) {
+            open_parts[++depth] = n_parts++;
+        }
+
+        part[i] = open_parts[depth];
+
+        if (line->kind == LINE_DIRECTIVE && !strncmp(line->mnemonic, ".popsection", 11) && depth > 0) {
+            depth--;
+        }
+    }
+
+    if (n_parts > 1) {
+        struct line_t *ordered = malloc(n_lines * sizeof(struct line_t));
+        size_t n_ordered = 0;
+        for (size_t p = 0; p < n_parts; p++) {
+            for (size_t i = 0; i < n_lines; i++) {
+                if (part[i] == p) {
+                    ordered[n_ordered++] = lines[i];
+                }
+            }
+        }
+        memcpy(lines, ordered, n_lines * sizeof(struct line_t));
+        free(ordered);
+    }
+
+    free(open_parts);
+    free(part);
+}
+
+static void simplify_control_flow(struct line_t *lines, size_t n_lines) {
+    separate_sections(lines, n_lines);
+
+    tlhash_t labels;
+    tlhash_init(&labels, 64);
+    for (size_t i = 0; i < n_lines; i++) {
+        if (lines[i].kind == LINE_LABEL) {
+            tlhash_insert(&labels, lines[i].mnemonic, strlen(lines[i].mnemonic), &lines[i]);
+        }
+    }
+
+    size_t *references = malloc(n_lines * sizeof(size_t));
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (size_t i = next_line(lines, n_lines, -1); i < n_lines; i = next_line(lines, n_lines, i)) {
+            struct line_t *line = &lines[i];
+            if (!is_jump(line)) {
+                continue;
+            }
+
+            // Jump straight to where a chain of jumps ends up, the number of
+            // steps is limited since the chain may be a loop
+            char *target = line->operands[0];
+            for (int steps = 0; steps < 16; steps++) {
+                size_t code = code_at_label(lines, n_lines, &labels, target);
+                if (code == n_lines || !is_unconditional_jump(&lines[code]) ||
+                    !strcmp(lines[code].operands[0], target)) {
+                    break;
+                }
+                target = lines[code].operands[0];
+            }
+            if (target != line->operands[0]) {
+                replace_operand(line, 0, target);
+                changed = true;
+            }
+
+            size_t next = next_line(lines, n_lines, i);
+
+            // Jumping to the next line
+            if (is_label_at(lines, n_lines, next, line->operands[0])) {
+                line->deleted = true;
+                changed = true;
+                continue;
+            }
+
+            // A conditional jump over an unconditional one is inverted, so
+            // that the code after them is reached by falling through
+            if (!is_unconditional_jump(line) && next < n_lines && is_unconditional_jump(&lines[next]) &&
+                is_label_at(lines, n_lines, next_line(lines, n_lines, next), line->operands[0])) {
+                invert_jump(line);
+                replace_operand(line, 0, lines[next].operands[0]);
+                lines[next].deleted = true;
+                changed = true;
+            }
+        }
+
+        // Code after a jump or return that no label leads to never runs
+        for (size_t i = next_line(lines, n_lines, -1); i < n_lines; i = next_line(lines, n_lines, i)) {
+            if (!ends_block(&lines[i])) {
+                continue;
+            }
+
+            size_t next = next_line(lines, n_lines, i);
+            while (next < n_lines && lines[next].kind == LINE_INSTRUCTION) {
+                lines[next].deleted = true;
+                changed = true;
+                next = next_line(lines, n_lines, next);
+            }
+        }
+
+        // Labels no jump goes to are removed, merging the code before and
+        // after them into one straight line. Only our own local labels are
+        // considered, the function itself is called from other places
+        memset(references, 0, n_lines * sizeof(size_t));
+        for (size_t i = 0; i < n_lines; i++) {
+            struct line_t *label_line;
+            char *target = lines[i].operands[0];
+            if (!lines[i].deleted && is_jump(&lines[i]) &&
+                tlhash_lookup(&labels, target, strlen(target), (void **)&label_line) == TLHASH_SUCCESS) {
+                references[label_line - lines]++;
+            }
+        }
+        for (size_t i = 0; i < n_lines; i++) {
+            if (!lines[i].deleted && lines[i].kind == LINE_LABEL && lines[i].mnemonic[0] == '.' &&
+                references[i] == 0) {
+                lines[i].deleted = true;
+                changed = true;
+            }
+        }
+    }
+
+    free(references);
+    tlhash_finalize(&labels);
+}
@@ -0,0 +1,825 @@
+#include <vslc.h>
+
+// State while building the SSA form of a function. Variables are resolved
+// to their definitions as the tree is walked, inserting phis where needed,
+// following Braun et al., "Simple and Efficient Construction of Static
+// Single Assignment Form"
+struct builder_t {
+    ssa_function_t *ssa;
+    // The block instructions are added to, never terminated
+    ssa_block_t *current;
+    // Where a continue statement jumps to
+    ssa_block_t *loop_header;
+};
+
+/**Adds the instructions of a statement to the function being built
+ * @param builder the state of the builder
+ * @param node the statement */
+static void build_statement(struct builder_t *builder, node_t *node);
+/**Adds the instructions computing an expression
+ * @param builder the state of the builder
+ * @param node the expression
+ * @return the instruction holding the value of the expression */
+static ssa_instruction_t *build_expression(struct builder_t *builder, node_t *node);
+/**Finds the value a variable has at the end of a block
+ * @param builder the state of the builder
+ * @param variable symbol table entry of a local variable or parameter
+ * @param block the block */
+static ssa_instruction_t *read_variable(struct builder_t *builder, symbol_t *variable, ssa_block_t *block);
+
+static ssa_block_t *create_block(ssa_function_t *ssa) {
+    if (ssa->n_blocks == ssa->capacity) {
+        ssa->capacity = ssa->capacity == 0 ? 8 : ssa->capacity * 2;
+        ssa->blocks = realloc(ssa->blocks, ssa->capacity * sizeof(ssa_block_t *));
+    }
+
+    ssa_block_t *block = calloc(1, sizeof(ssa_block_t));
+    block->id = ssa->n_blocks;
+    tlhash_init(&block->definitions, 8);
+    ssa->blocks[ssa->n_blocks++] = block;
+    return block;
+}
+
+ssa_instruction_t *ssa_create_instruction(ssa_opcode_t opcode, size_t n_operands) {
+    ssa_instruction_t *instruction = calloc(1, sizeof(ssa_instruction_t));
+    instruction->opcode = opcode;
+    instruction->n_operands = n_operands;
+    instruction->operands = calloc(n_operands == 0 ? 1 : n_operands, sizeof(ssa_instruction_t *));
+    return instruction;
+}
+
+void ssa_insert_instruction(ssa_block_t *block, ssa_instruction_t *instruction, size_t position) {
+    if (block->n_instructions == block->capacity) {
+        block->capacity = block->capacity == 0 ? 8 : block->capacity * 2;
+        block->instructions = realloc(block->instructions, block->capacity * sizeof(ssa_instruction_t *));
+    }
+
+    memmove(&block->instructions[position + 1], &block->instructions[position],
+            (block->n_instructions - position) * sizeof(ssa_instruction_t *));
+    block->instructions[position] = instruction;
+    block->n_instructions++;
+    instruction->block = block;
+}
+
+static ssa_instruction_t *append(struct builder_t *builder, ssa_opcode_t opcode, size_t n_operands) {
+    ssa_instruction_t *instruction = ssa_create_instruction(opcode, n_operands);
+    ssa_insert_instruction(builder->current, instruction, builder->current->n_instructions);
+    return instruction;
+}
+
+static ssa_instruction_t *append_constant(struct builder_t *builder, int64_t constant) {
+    ssa_instruction_t *instruction = append(builder, SSA_CONSTANT, 0);
+    instruction->constant = constant;
+    return instruction;
+}
+
+static void add_edge(ssa_block_t *from, ssa_block_t *to) {
+    from->successors[from->n_successors++] = to;
+
+    if (to->n_predecessors == to->predecessor_capacity) {
+        to->predecessor_capacity = to->predecessor_capacity == 0 ? 2 : to->predecessor_capacity * 2;
+        to->predecessors = realloc(to->predecessors, to->predecessor_capacity * sizeof(ssa_block_t *));
+    }
+    to->predecessors[to->n_predecessors++] = from;
+}
+
+/**Ends the current block with a terminator, and continues in a new block
+ * that nothing leads to. Code after a return or continue ends up there */
+static void terminate_unreachable(struct builder_t *builder) {
+    builder->current = create_block(builder->ssa);
+    builder->current->sealed = true;
+}
+
+static void jump(struct builder_t *builder, ssa_block_t *target) {
+    append(builder, SSA_JUMP, 0);
+    add_edge(builder->current, target);
+}
+
+static void branch(struct builder_t *builder, node_t *relation, ssa_block_t *if_true, ssa_block_t *if_false) {
+    ssa_instruction_t *lhs = build_expression(builder, relation->children[0]);
+    ssa_instruction_t *rhs = build_expression(builder, relation->children[1]);
+
+    ssa_instruction_t *instruction = append(builder, SSA_BRANCH, 2);
+    instruction->op = *((char *)relation->data);
+    instruction->operands[0] = lhs;
+    instruction->operands[1] = rhs;
+    add_edge(builder->current, if_true);
+    add_edge(builder->current, if_false);
+}
+
+bool ssa_has_value(ssa_instruction_t *instruction) {
+    switch (instruction->opcode) {
+        case SSA_STORE_GLOBAL:
+        case SSA_PRINT_TEXT:
+        case SSA_PRINT_VALUE:
+        case SSA_JUMP:
+        case SSA_BRANCH:
+        case SSA_RETURN:
+            return false;
+        default:
+            return true;
+    }
+}
+
+ssa_instruction_t *ssa_resolve(ssa_instruction_t *instruction) {
+    while (instruction->replacement != NULL) {
+        instruction = instruction->replacement;
+    }
+    return instruction;
+}
+
+static void write_variable(symbol_t *variable, ssa_block_t *block, ssa_instruction_t *value) {
+    tlhash_remove(&block->definitions, &variable, sizeof(symbol_t *));
+    tlhash_insert(&block->definitions, &variable, sizeof(symbol_t *), value);
+}
+
+static ssa_instruction_t *create_phi(ssa_block_t *block, symbol_t *variable) {
+    ssa_instruction_t *phi = ssa_create_instruction(SSA_PHI, 0);
+    phi->symbol = variable;
+
+    size_t position = 0;
+    while (position < block->n_instructions && block->instructions[position]->opcode == SSA_PHI) {
+        position++;
+    }
+    ssa_insert_instruction(block, phi, position);
+    return phi;
+}
+
+static void add_phi_operands(struct builder_t *builder, ssa_instruction_t *phi) {
+    ssa_block_t *block = phi->block;
+    free(phi->operands);
+    phi->n_operands = block->n_predecessors;
+    phi->operands = malloc(block->n_predecessors * sizeof(ssa_instruction_t *));
+
+    for (size_t i = 0; i < block->n_predecessors; i++) {
+        phi->operands[i] = read_variable(builder, phi->symbol, block->predecessors[i]);
+    }
+}
+
+ssa_instruction_t *read_variable(struct builder_t *builder, symbol_t *variable, ssa_block_t *block) {
+    ssa_instruction_t *value;
+    if (tlhash_lookup(&block->definitions, &variable, sizeof(symbol_t *), (void **)&value) == TLHASH_SUCCESS) {
+        return value;
+    }
+
+    if (!block->sealed) {
+        // More predecessors may be added, the operands are filled in when
+        // the block is sealed
+        value = create_phi(block, variable);
+    } else if (block->n_predecessors == 0) {
+        // The entry block, or code that can't be reached. Variables that
+        // have not been assigned are zero
+        value = ssa_create_instruction(SSA_CONSTANT, 0);
+        value->constant = 0;
+        ssa_insert_instruction(block, value, 0);
+    } else if (block->n_predecessors == 1) {
+        value = read_variable(builder, variable, block->predecessors[0]);
+    } else {
+        // The phi is defined before its operands are looked up, which ends
+        // the search if it comes back around a loop
+        value = create_phi(block, variable);
+        write_variable(variable, block, value);
+        add_phi_operands(builder, value);
+    }
+
+    write_variable(variable, block, value);
+    return value;
+}
+
+/**Marks that all predecessors of a block are known, and completes the phis
+ * created while they were not */
+static void seal_block(struct builder_t *builder, ssa_block_t *block) {
+    for (size_t i = 0; i < block->n_instructions && block->instructions[i]->opcode == SSA_PHI; i++) {
+        if (block->instructions[i]->n_operands == 0) {
+            add_phi_operands(builder, block->instructions[i]);
+        }
+    }
+    block->sealed = true;
+}
+
+ssa_instruction_t *build_expression(struct builder_t *builder, node_t *node) {
+    ssa_instruction_t *instruction;
+    symbol_t *symbol;
+
+    switch (node->type) {
+        case NUMBER_DATA:
+            return append_constant(builder, *((int64_t *)node->data));
+
+        case IDENTIFIER_DATA:
+            symbol = node->entry;
+            if (symbol->type == SYM_GLOBAL_VAR) {
+                instruction = append(builder, SSA_LOAD_GLOBAL, 0);
+                instruction->symbol = symbol;
+                return instruction;
+            }
+            return read_variable(builder, symbol, builder->current);
+
+        case EXPRESSION:
+            break;
+
+        default:
+            fprintf(stderr, "Unexpected %s in expression\n", node_string[node->type]);
+            exit(EXIT_FAILURE);
+    }
+
+    // Function call
+    if (node->data == NULL) {
+        node_t *arguments = node->children[1];
+        symbol = node->children[0]->entry;
+
+        size_t n_arguments = arguments == NULL ? 0 : arguments->n_children;
+        if (n_arguments != symbol->nparms) {
+            fprintf(stderr, "Wrong number of arguments for call to %s in %s\n", symbol->name,
+                    builder->ssa->function->name);
+            exit(EXIT_FAILURE);
+        }
+
+        ssa_instruction_t *values[n_arguments + 1];
+        for (size_t i = 0; i < n_arguments; i++) {
+            values[i] = build_expression(builder, arguments->children[i]);
+        }
+
+        instruction = append(builder, SSA_CALL, n_arguments);
+        instruction->symbol = symbol;
+        memcpy(instruction->operands, values, n_arguments * sizeof(ssa_instruction_t *));
+        return instruction;
+    }
+
+    if (node->n_children == 1) {
+        ssa_instruction_t *operand = build_expression(builder, node->children[0]);
+        instruction = append(builder, SSA_UNARY, 1);
+        instruction->op = *((char *)node->data);
+        instruction->operands[0] = operand;
+        return instruction;
+    }
+
+    // The right hand side is evaluated first, like the code generator does
+    ssa_instruction_t *rhs = build_expression(builder, node->children[1]);
+    ssa_instruction_t *lhs = build_expression(builder, node->children[0]);
+    instruction = append(builder, SSA_BINARY, 2);
+    instruction->op = *((char *)node->data);
+    instruction->operands[0] = lhs;
+    instruction->operands[1] = rhs;
+    return instruction;
+}
+
+static void build_assignment(struct builder_t *builder, node_t *node) {
+    symbol_t *variable = node->children[0]->entry;
+    ssa_instruction_t *value = build_expression(builder, node->children[1]);
+
+    char op = 0;
+    switch (node->type) {
+        case ADD_STATEMENT:
+            op = '+';
+            break;
+        case SUBTRACT_STATEMENT:
+            op = '-';
+            break;
+        case MULTIPLY_STATEMENT:
+            op = '*';
+            break;
+        case DIVIDE_STATEMENT:
+            op = '/';
+            break;
+        default:
+            break;
+    }
+
+    if (op != 0) {
+        // The variable is read after the value is computed, which may
+        // change it if it is a global
+        ssa_instruction_t *current = build_expression(builder, node->children[0]);
+        ssa_instruction_t *instruction = append(builder, SSA_BINARY, 2);
+        instruction->op = op;
+        instruction->operands[0] = current;
+        instruction->operands[1] = value;
+        value = instruction;
+    }
+
+    if (variable->type == SYM_GLOBAL_VAR) {
+        ssa_instruction_t *store = append(builder, SSA_STORE_GLOBAL, 1);
+        store->symbol = variable;
+        store->operands[0] = value;
+    } else {
+        write_variable(variable, builder->current, value);
+    }
+}
+
+static void print_text(struct builder_t *builder, FILE **text_stream, char **text, size_t *text_size) {
+    fclose(*text_stream);
+
+    if (*text_size == 0) {
+        free(*text);
+    } else {
+        ssa_instruction_t *instruction = append(builder, SSA_PRINT_TEXT, 0);
+        instruction->text = *text;
+    }
+
+    *text_stream = open_memstream(text, text_size);
+}
+
+static void build_print_statement(struct builder_t *builder, node_t *node) {
+    // Constant items are joined into pieces of text, like the code generator
+    // does. The text is escaped for the assembler
+    char *text;
+    size_t text_size;
+    FILE *text_stream = open_memstream(&text, &text_size);
+
+    for (size_t i = 0; i < node->n_children; i++) {
+        node_t *item = node->children[i];
+        char *string;
+
+        switch (item->type) {
+            case STRING_DATA:
+                string = string_list[*((size_t *)item->data)];
+                fprintf(text_stream, "%.*s ", (int)strlen(string) - 2, string + 1);
+                break;
+            case NUMBER_DATA:
+                fprintf(text_stream, "%ld ", *((int64_t *)item->data));
+                break;
+            default:
+                print_text(builder, &text_stream, &text, &text_size);
+                ssa_instruction_t *value = build_expression(builder, item);
+                append(builder, SSA_PRINT_VALUE, 1)->operands[0] = value;
+                break;
+        }
+    }
+
+    fputs("\\n", text_stream);
+    print_text(builder, &text_stream, &text, &text_size);
+    fclose(text_stream);
+    free(text);
+}
+
+static void build_if_statement(struct builder_t *builder, node_t *node) {
+    ssa_block_t *then_block = create_block(builder->ssa);
+    ssa_block_t *end_block = create_block(builder->ssa);
+    ssa_block_t *else_block = node->n_children == 3 ? create_block(builder->ssa) : end_block;
+
+    branch(builder, node->children[0], then_block, else_block);
+
+    seal_block(builder, then_block);
+    builder->current = then_block;
+    build_statement(builder, node->children[1]);
+    jump(builder, end_block);
+
+    if (node->n_children == 3) {
+        seal_block(builder, else_block);
+        builder->current = else_block;
+        build_statement(builder, node->children[2]);
+        jump(builder, end_block);
+    }
+
+    seal_block(builder, end_block);
+    builder->current = end_block;
+}
+
+static void build_while_statement(struct builder_t *builder, node_t *node) {
+    // The header is sealed once the body, with all the jumps back to it,
+    // has been built
+    ssa_block_t *header = create_block(builder->ssa);
+    ssa_block_t *body = create_block(builder->ssa);
+    ssa_block_t *exit = create_block(builder->ssa);
+    header->is_loop_header = true;
+
+    jump(builder, header);
+    builder->current = header;
+    branch(builder, node->children[0], body, exit);
+
+    ssa_block_t *surrounding_header = builder->loop_header;
+    builder->loop_header = header;
+
+    seal_block(builder, body);
+    builder->current = body;
+    build_statement(builder, node->children[1]);
+    jump(builder, header);
+
+    builder->loop_header = surrounding_header;
+    seal_block(builder, header);
+    seal_block(builder, exit);
+    builder->current = exit;
+}
+
+void build_statement(struct builder_t *builder, node_t *node) {
+    ssa_instruction_t *value;
+
+    switch (node->type) {
+        case BLOCK:
+        case STATEMENT_LIST:
+            for (size_t i = 0; i < node->n_children; i++) {
+                build_statement(builder, node->children[i]);
+            }
+            break;
+        case DECLARATION_LIST:
+        case DECLARATION:
+            break;
+        case ASSIGNMENT_STATEMENT:
+        case ADD_STATEMENT:
+        case SUBTRACT_STATEMENT:
+        case MULTIPLY_STATEMENT:
+        case DIVIDE_STATEMENT:
+            build_assignment(builder, node);
+            break;
+        case PRINT_STATEMENT:
+            build_print_statement(builder, node);
+            break;
+        case RETURN_STATEMENT:
+            value = build_expression(builder, node->children[0]);
+            append(builder, SSA_RETURN, 1)->operands[0] = value;
+            terminate_unreachable(builder);
+            break;
+        case IF_STATEMENT:
+            build_if_statement(builder, node);
+            break;
+        case WHILE_STATEMENT:
+            build_while_statement(builder, node);
+            break;
+        case NULL_STATEMENT:
+            if (builder->loop_header == NULL) {
+                fprintf(stderr, "Continue in illegal position inside %s\n", builder->ssa->function->name);
+                exit(EXIT_FAILURE);
+            }
+            jump(builder, builder->loop_header);
+            terminate_unreachable(builder);
+            break;
+        default:
+            // Expressions used as statements, for their side effects
+            build_expression(builder, node);
+            break;
+    }
+}
+
+ssa_function_t *build_ssa_function(symbol_t *function) {
+    ssa_function_t *ssa = calloc(1, sizeof(ssa_function_t));
+    ssa->function = function;
+
+    struct builder_t builder = {.ssa = ssa, .current = create_block(ssa), .loop_header = NULL};
+    builder.current->sealed = true;
+
+    // The parameters are defined in the entry block
+    size_t n_locals = tlhash_size(function->locals);
+    symbol_t *locals[n_locals];
+    tlhash_values(function->locals, (void **)locals);
+    for (size_t seq = 0; seq < function->nparms; seq++) {
+        for (size_t i = 0; i < n_locals; i++) {
+            if (locals[i]->type == SYM_PARAMETER && locals[i]->seq == seq) {
+                ssa_instruction_t *parameter = append(&builder, SSA_PARAMETER, 0);
+                parameter->parameter = seq;
+                parameter->symbol = locals[i];
+                write_variable(locals[i], builder.current, parameter);
+            }
+        }
+    }
+
+    build_statement(&builder, function->node);
+
+    // Falling off the end of a function returns zero
+    ssa_instruction_t *zero = append_constant(&builder, 0);
+    append(&builder, SSA_RETURN, 1)->operands[0] = zero;
+
+    ssa_clean_up(ssa);
+    return ssa;
+}
+
+static void destroy_instruction(ssa_instruction_t *instruction) {
+    free(instruction->operands);
+    free(instruction->text);
+    free(instruction);
+}
+
+static void destroy_block(ssa_block_t *block) {
+    for (size_t i = 0; i < block->n_instructions; i++) {
+        destroy_instruction(block->instructions[i]);
+    }
+    free(block->instructions);
+    free(block->predecessors);
+    tlhash_finalize(&block->definitions);
+    free(block);
+}
+
+void destroy_ssa_function(ssa_function_t *ssa) {
+    for (size_t i = 0; i < ssa->n_blocks; i++) {
+        destroy_block(ssa->blocks[i]);
+    }
+    free(ssa->blocks);
+    free(ssa);
+}
+
+static void visit_postorder(ssa_block_t *block, bool *visited, ssa_block_t **order, size_t *n_order) {
+    visited[block->id] = true;
+    // The successors are visited in reverse, so the first one ends up
+    // first in the reverse postorder
+    for (size_t i = block->n_successors; i > 0; i--) {
+        if (!visited[block->successors[i - 1]->id]) {
+            visit_postorder(block->successors[i - 1], visited, order, n_order);
+        }
+    }
+    order[(*n_order)++] = block;
+}
+
+void ssa_clean_up(ssa_function_t *ssa) {
+    bool visited[ssa->n_blocks];
+    memset(visited, 0, sizeof(visited));
+    ssa_block_t *order[ssa->n_blocks];
+    size_t n_order = 0;
+    visit_postorder(ssa->blocks[0], visited, order, &n_order);
+
+    // Edges from unreachable blocks are removed, along with the matching
+    // phi operands
+    for (size_t b = 0; b < n_order; b++) {
+        ssa_block_t *block = order[b];
+        size_t kept = 0;
+        for (size_t p = 0; p < block->n_predecessors; p++) {
+            if (!visited[block->predecessors[p]->id]) {
+                continue;
+            }
+
+            for (size_t i = 0; i < block->n_instructions && block->instructions[i]->opcode == SSA_PHI; i++) {
+                block->instructions[i]->operands[kept] = block->instructions[i]->operands[p];
+            }
+            block->predecessors[kept++] = block->predecessors[p];
+        }
+
+        block->n_predecessors = kept;
+        for (size_t i = 0; i < block->n_instructions && block->instructions[i]->opcode == SSA_PHI; i++) {
+            block->instructions[i]->n_operands = kept;
+        }
+    }
+
+    // A phi is not needed when its operands are all the same value, apart
+    // from itself. Removing one may make others trivial as well
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = 0; b < n_order; b++) {
+            ssa_block_t *block = order[b];
+            for (size_t i = 0; i < block->n_instructions && block->instructions[i]->opcode == SSA_PHI; i++) {
+                ssa_instruction_t *phi = block->instructions[i];
+                if (phi->replacement != NULL) {
+                    continue;
+                }
+
+                ssa_instruction_t *same = NULL;
+                bool trivial = true;
+                for (size_t o = 0; o < phi->n_operands && trivial; o++) {
+                    ssa_instruction_t *operand = ssa_resolve(phi->operands[o]);
+                    if (operand == phi || operand == same) {
+                        continue;
+                    }
+                    trivial = same == NULL;
+                    same = operand;
+                }
+
+                if (trivial && same != NULL) {
+                    phi->replacement = same;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for (size_t b = 0; b < ssa->n_blocks; b++) {
+        if (!visited[b]) {
+            destroy_block(ssa->blocks[b]);
+        }
+    }
+
+    ssa->n_blocks = 0;
+    for (size_t b = n_order; b > 0; b--) {
+        ssa->blocks[ssa->n_blocks++] = order[b - 1];
+    }
+
+    ssa_apply_replacements(ssa);
+
+    // Loops may have gone away along with the edges
+    for (size_t b = 0; b < ssa->n_blocks; b++) {
+        ssa_block_t *block = ssa->blocks[b];
+        block->is_loop_header = false;
+        for (size_t p = 0; p < block->n_predecessors; p++) {
+            block->is_loop_header |= block->predecessors[p]->id >= block->id;
+        }
+    }
+}
+
+void ssa_remove_edge(ssa_block_t *block, size_t successor) {
+    ssa_block_t *target = block->successors[successor];
+    block->successors[successor] = block->successors[--block->n_successors];
+
+    size_t edge = 0;
+    while (target->predecessors[edge] != block) {
+        edge++;
+    }
+
+    target->n_predecessors--;
+    target->predecessors[edge] = target->predecessors[target->n_predecessors];
+    for (size_t i = 0; i < target->n_instructions && target->instructions[i]->opcode == SSA_PHI; i++) {
+        ssa_instruction_t *phi = target->instructions[i];
+        phi->operands[edge] = phi->operands[--phi->n_operands];
+    }
+}
+
+void ssa_apply_replacements(ssa_function_t *ssa) {
+    for (size_t b = 0; b < ssa->n_blocks; b++) {
+        ssa_block_t *block = ssa->blocks[b];
+        for (size_t i = 0; i < block->n_instructions; i++) {
+            ssa_instruction_t *instruction = block->instructions[i];
+            for (size_t o = 0; o < instruction->n_operands; o++) {
+                instruction->operands[o] = ssa_resolve(instruction->operands[o]);
+            }
+        }
+    }
+
+    // Only now can the replaced instructions be freed, as resolving the
+    // operands needed them
+    for (size_t b = 0; b < ssa->n_blocks; b++) {
+        ssa_block_t *block = ssa->blocks[b];
+        size_t kept = 0;
+        for (size_t i = 0; i < block->n_instructions; i++) {
+            if (block->instructions[i]->replacement != NULL) {
+                destroy_instruction(block->instructions[i]);
+            } else {
+                block->instructions[kept++] = block->instructions[i];
+            }
+        }
+        block->n_instructions = kept;
+    }
+
+    // Numbering of the blocks and values in order
+    ssa->n_values = 0;
+    for (size_t b = 0; b < ssa->n_blocks; b++) {
+        ssa_block_t *block = ssa->blocks[b];
+        block->id = b;
+
+        for (size_t i = 0; i < block->n_instructions; i++) {
+            if (ssa_has_value(block->instructions[i])) {
+                block->instructions[i]->id = ssa->n_values++;
+            }
+        }
+    }
+}
+
+void split_critical_edges(ssa_function_t *ssa) {
+    size_t n_blocks = ssa->n_blocks;
+    for (size_t b = 0; b < n_blocks; b++) {
+        ssa_block_t *block = ssa->blocks[b];
+        if (block->n_successors < 2) {
+            continue;
+        }
+
+        for (size_t s = 0; s < block->n_successors; s++) {
+            ssa_block_t *successor = block->successors[s];
+            if (successor->n_predecessors < 2) {
+                continue;
+            }
+
+            ssa_block_t *split = create_block(ssa);
+            ssa_instruction_t *instruction = ssa_create_instruction(SSA_JUMP, 0);
+            ssa_insert_instruction(split, instruction, 0);
+            split->successors[split->n_successors++] = successor;
+            split->predecessors = malloc(sizeof(ssa_block_t *));
+            split->predecessors[0] = block;
+            split->n_predecessors = split->predecessor_capacity = 1;
+
+            block->successors[s] = split;
+            for (size_t p = 0; p < successor->n_predecessors; p++) {
+                if (successor->predecessors[p] == block) {
+                    successor->predecessors[p] = split;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void print_value(ssa_instruction_t *instruction) {
+    printf("v%lu", instruction->id);
+}
+
+static void print_instruction(ssa_instruction_t *instruction) {
+    printf("    ");
+    if (ssa_has_value(instruction)) {
+        print_value(instruction);
+        printf(" = ");
+    }
+
+    switch (instruction->opcode) {
+        case SSA_CONSTANT:
+            printf("%ld", instruction->constant);
+            break;
+        case SSA_PARAMETER:
+            printf("parameter %lu (%s)", instruction->parameter, instruction->symbol->name);
+            break;
+        case SSA_LOAD_GLOBAL:
+            printf("load %s", instruction->symbol->name);
+            break;
+        case SSA_STORE_GLOBAL:
+            printf("store %s, ", instruction->symbol->name);
+            print_value(instruction->operands[0]);
+            break;
+        case SSA_UNARY:
+            printf("%c", instruction->op);
+            print_value(instruction->operands[0]);
+            break;
+        case SSA_BINARY:
+        case SSA_BRANCH:
+            if (instruction->opcode == SSA_BRANCH) {
+                printf("branch ");
+            }
+            print_value(instruction->operands[0]);
+            if (instruction->opcode == SSA_BINARY && instruction->op == '>') {
+                printf(" >> ");
+            } else {
+                printf(" %c ", instruction->op);
+            }
+            print_value(instruction->operands[1]);
+            if (instruction->narrow) {
+                printf(" (unsigned 32 bit)");
+            }
+            if (instruction->opcode == SSA_BRANCH) {
+                printf(", B%lu, B%lu", instruction->block->successors[0]->id,
+                       instruction->block->successors[1]->id);
+            }
+            break;
+        case SSA_CALL:
+            printf("call %s(", instruction->symbol->name);
+            for (size_t i = 0; i < instruction->n_operands; i++) {
+                printf(i == 0 ? "" : ", ");
+                print_value(instruction->operands[i]);
+            }
+            printf(")");
+            break;
+        case SSA_PHI:
+            printf("phi");
+            for (size_t i = 0; i < instruction->n_operands; i++) {
+                printf(i == 0 ? " [" : ", [");
+                print_value(instruction->operands[i]);
+                printf(", B%lu]", instruction->block->predecessors[i]->id);
+            }
+            break;
+        case SSA_PRINT_TEXT:
+            printf("print \"%s\"", instruction->text);
+            break;
+        case SSA_PRINT_VALUE:
+            printf("print ");
+            print_value(instruction->operands[0]);
+            break;
+        case SSA_JUMP:
+            printf("jump B%lu", instruction->block->successors[0]->id);
+            break;
+        case SSA_RETURN:
+            printf("return ");
+            print_value(instruction->operands[0]);
+            break;
+    }
+    putchar('\n');
+}
+
+void print_ssa_function(ssa_function_t *ssa) {
+    printf("function %s\n", ssa->function->name);
+    for (size_t b = 0; b < ssa->n_blocks; b++) {
+        ssa_block_t *block = ssa->blocks[b];
+        printf("B%lu:", block->id);
+        if (block->n_predecessors > 0) {
+            printf(" ; from");
+            for (size_t p = 0; p < block->n_predecessors; p++) {
+                printf(" B%lu", block->predecessors[p]->id);
+            }
+        }
+        if (block->is_loop_header) {
+            printf(", loop header");
+        }
+        putchar('\n');
+
+        for (size_t i = 0; i < block->n_instructions; i++) {
+            print_instruction(block->instructions[i]);
+        }
+    }
+}
+
+static int compare_functions(const void *a, const void *b) {
+    size_t seq_a = (*(symbol_t *const *)a)->seq, seq_b = (*(symbol_t *const *)b)->seq;
+    return seq_a < seq_b ? -1 : seq_a > seq_b;
+}
+
+void print_ssa_program(void) {
+    size_t n_globals = tlhash_size(global_names);
+    symbol_t *globals[n_globals];
+    tlhash_values(global_names, (void **)globals);
+
+    // In the order they were declared
+    size_t n_functions = 0;
+    for (size_t i = 0; i < n_globals; i++) {
+        if (globals[i]->type == SYM_FUNCTION) {
+            globals[n_functions++] = globals[i];
+        }
+    }
+    qsort(globals, n_functions, sizeof(symbol_t *), compare_functions);
+
+    for (size_t i = 0; i < n_functions; i++) {
+        ssa_function_t *ssa = build_ssa_function(globals[i]);
+        optimize_ssa_function(ssa);
+        print_ssa_function(ssa);
+        destroy_ssa_function(ssa);
+        putchar('\n');
+    }
+}
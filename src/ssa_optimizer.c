@@ -0,0 +1,630 @@
+#include <vslc.h>
+
+// Set by the -fgvn flag, defined in vslc.c
+extern bool global_value_numbering;
+// Set by the -fvrp flag, defined in vslc.c
+extern bool value_range_propagation;
+
+/**Finds the immediate dominator of every block, using the algorithm of
+ * Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm"
+ * @param ssa the function, with its blocks in reverse postorder
+ * @param idom filled with the immediate dominator of each block by id. The
+ *             entry block is its own */
+static void find_dominators(ssa_function_t *ssa, ssa_block_t **idom);
+/**Makes instructions that compute the same value as an earlier one use
+ * that instead
+ * @param ssa the function */
+static void number_values(ssa_function_t *ssa);
+/**Finds the range of values each instruction may produce, and uses it to
+ * pick cheaper divisions and to remove branches that always go one way
+ * @param ssa the function */
+static void propagate_value_ranges(ssa_function_t *ssa);
+
+void optimize_ssa_function(ssa_function_t *ssa) {
+    if (global_value_numbering) {
+        number_values(ssa);
+    }
+    if (value_range_propagation) {
+        propagate_value_ranges(ssa);
+    }
+}
+
+static ssa_block_t *intersect(ssa_block_t **idom, ssa_block_t *a, ssa_block_t *b) {
+    while (a != b) {
+        while (a->id > b->id) {
+            a = idom[a->id];
+        }
+        while (b->id > a->id) {
+            b = idom[b->id];
+        }
+    }
+    return a;
+}
+
+void find_dominators(ssa_function_t *ssa, ssa_block_t **idom) {
+    for (size_t b = 0; b < ssa->n_blocks; b++) {
+        idom[b] = NULL;
+    }
+    idom[0] = ssa->blocks[0];
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = 1; b < ssa->n_blocks; b++) {
+            ssa_block_t *block = ssa->blocks[b];
+            ssa_block_t *dominator = NULL;
+            for (size_t p = 0; p < block->n_predecessors; p++) {
+                ssa_block_t *predecessor = block->predecessors[p];
+                if (idom[predecessor->id] == NULL) {
+                    continue;
+                }
+                dominator = dominator == NULL ? predecessor : intersect(idom, predecessor, dominator);
+            }
+
+            if (idom[b] != dominator) {
+                idom[b] = dominator;
+                changed = true;
+            }
+        }
+    }
+}
+
+static bool dominates(ssa_block_t **idom, ssa_block_t *a, ssa_block_t *b) {
+    // Dominators always come earlier in reverse postorder
+    while (b->id > a->id) {
+        b = idom[b->id];
+    }
+    return a == b;
+}
+
+// What makes two instructions compute the same value
+struct value_key_t {
+    ssa_opcode_t opcode;
+    char op;
+    int64_t constant;
+    ssa_instruction_t *operands[2];
+};
+
+static bool is_commutative(char op) {
+    return op == '+' || op == '*' || op == '&' || op == '|' || op == '^';
+}
+
+/**Finds the key of an instruction whose value only depends on its operands
+ * @param instruction the instruction
+ * @param key filled with the key, with all padding cleared so it can be
+ *            hashed as bytes
+ * @return false if the instruction may give a different value each time */
+static bool make_value_key(ssa_instruction_t *instruction, struct value_key_t *key) {
+    memset(key, 0, sizeof(struct value_key_t));
+    key->opcode = instruction->opcode;
+    key->op = instruction->op;
+
+    switch (instruction->opcode) {
+        case SSA_CONSTANT:
+            key->constant = instruction->constant;
+            return true;
+        case SSA_UNARY:
+            key->operands[0] = ssa_resolve(instruction->operands[0]);
+            return true;
+        case SSA_BINARY:
+            key->operands[0] = ssa_resolve(instruction->operands[0]);
+            key->operands[1] = ssa_resolve(instruction->operands[1]);
+            if (is_commutative(instruction->op) && key->operands[0] > key->operands[1]) {
+                ssa_instruction_t *operand = key->operands[0];
+                key->operands[0] = key->operands[1];
+                key->operands[1] = operand;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The instructions computing one value, in the order they were found
+struct value_list_t {
+    ssa_instruction_t **instructions;
+    size_t count;
+    size_t capacity;
+};
+
+void number_values(ssa_function_t *ssa) {
+    ssa_block_t *idom[ssa->n_blocks];
+    find_dominators(ssa, idom);
+
+    // The blocks are visited in reverse postorder, so an instruction in a
+    // dominating block has always been seen before the ones it dominates.
+    // A division is only reused where an earlier one already ran, so this
+    // never makes one trap where it didn't
+    tlhash_t values;
+    tlhash_init(&values, 64);
+
+    // Globals are only followed within a block. Their last known value
+    // there, keyed by the symbol, is forgotten at calls which may change them
+    tlhash_t globals;
+    tlhash_init(&globals, 8);
+
+    for (size_t b = 0; b < ssa->n_blocks; b++) {
+        ssa_block_t *block = ssa->blocks[b];
+
+        for (size_t i = 0; i < block->n_instructions; i++) {
+            ssa_instruction_t *instruction = block->instructions[i];
+            ssa_instruction_t *known;
+            symbol_t *global = instruction->symbol;
+
+            switch (instruction->opcode) {
+                case SSA_LOAD_GLOBAL:
+                    if (tlhash_lookup(&globals, &global, sizeof(symbol_t *), (void **)&known) == TLHASH_SUCCESS) {
+                        instruction->replacement = known;
+                    } else {
+                        tlhash_insert(&globals, &global, sizeof(symbol_t *), instruction);
+                    }
+                    continue;
+                case SSA_STORE_GLOBAL:
+                    tlhash_remove(&globals, &global, sizeof(symbol_t *));
+                    tlhash_insert(&globals, &global, sizeof(symbol_t *), ssa_resolve(instruction->operands[0]));
+                    continue;
+                case SSA_CALL:
+                    tlhash_finalize(&globals);
+                    tlhash_init(&globals, 8);
+                    continue;
+                default:
+                    break;
+            }
+
+            struct value_key_t key;
+            if (!make_value_key(instruction, &key)) {
+                continue;
+            }
+
+            struct value_list_t *list;
+            if (tlhash_lookup(&values, &key, sizeof(key), (void **)&list) != TLHASH_SUCCESS) {
+                list = calloc(1, sizeof(struct value_list_t));
+                tlhash_insert(&values, &key, sizeof(key), list);
+            }
+
+            for (size_t l = 0; l < list->count && instruction->replacement == NULL; l++) {
+                if (dominates(idom, list->instructions[l]->block, block)) {
+                    instruction->replacement = list->instructions[l];
+                }
+            }
+
+            if (instruction->replacement == NULL) {
+                if (list->count == list->capacity) {
+                    list->capacity = list->capacity == 0 ? 2 : list->capacity * 2;
+                    list->instructions = realloc(list->instructions, list->capacity * sizeof(ssa_instruction_t *));
+                }
+                list->instructions[list->count++] = instruction;
+            }
+        }
+
+        tlhash_finalize(&globals);
+        tlhash_init(&globals, 8);
+    }
+
+    size_t n_lists = tlhash_size(&values);
+    struct value_list_t *lists[n_lists + 1];
+    tlhash_values(&values, (void **)lists);
+    for (size_t l = 0; l < n_lists; l++) {
+        free(lists[l]->instructions);
+        free(lists[l]);
+    }
+    tlhash_finalize(&values);
+    tlhash_finalize(&globals);
+
+    ssa_apply_replacements(ssa);
+}
+
+// The values an instruction may produce, from min to max
+struct range_t {
+    int64_t min;
+    int64_t max;
+};
+
+static const struct range_t FULL_RANGE = {INT64_MIN, INT64_MAX};
+
+// State of the range analysis of a function
+struct range_analysis_t {
+    ssa_block_t **idom;
+    // The range of each value by id, valid if it is known
+    struct range_t *ranges;
+    bool *known;
+    // The number of times the range of each phi has grown
+    unsigned int *growth;
+};
+
+// Number of times the range of a phi may grow before it is widened to
+// the end of the type, so loops are analyzed in a few passes
+#define RANGE_GROWTH_LIMIT 2
+// Number of passes that recompute the ranges after they stop growing, which
+// tightens ranges that were widened too much
+#define RANGE_NARROWING_PASSES 2
+
+/**Narrows the range of a value by the outcome of a branch comparing it
+ * @param range the range to narrow
+ * @param relation how the value relates to the other operand when the
+ *                 branch is taken: '<', '>' or '='
+ * @param other the range of the other operand
+ * @param taken if the branch was taken
+ * @return the narrowed range */
+static struct range_t narrow_by_relation(struct range_t range, char relation, struct range_t other, bool taken) {
+    struct range_t narrowed = range;
+
+    switch (relation) {
+        case '<':
+            if (taken && other.max > INT64_MIN) {
+                narrowed.max = MIN(range.max, other.max - 1);
+            } else if (!taken) {
+                narrowed.min = MAX(range.min, other.min);
+            }
+            break;
+        case '>':
+            if (taken && other.min < INT64_MAX) {
+                narrowed.min = MAX(range.min, other.min + 1);
+            } else if (!taken) {
+                narrowed.max = MIN(range.max, other.max);
+            }
+            break;
+        case '=':
+            if (taken) {
+                narrowed.min = MAX(range.min, other.min);
+                narrowed.max = MIN(range.max, other.max);
+            } else if (other.min == other.max && range.min == other.min) {
+                narrowed.min++;
+            } else if (other.min == other.max && range.max == other.max) {
+                narrowed.max--;
+            }
+            break;
+    }
+
+    // The branch can't go this way at all. Keep the range as it was, since
+    // the code is never run
+    return narrowed.min <= narrowed.max ? narrowed : range;
+}
+
+/**Finds the range of a value where it is used. The range of the value is
+ * narrowed by the branches that have to be taken to get there
+ * @param analysis the state of the analysis
+ * @param value the value
+ * @param block the block the value is used in */
+static struct range_t range_in_block(struct range_analysis_t *analysis, ssa_instruction_t *value, ssa_block_t *block) {
+    struct range_t range = analysis->known[value->id] ? analysis->ranges[value->id] : FULL_RANGE;
+
+    // Each dominator reached along a single edge from a branch is only run
+    // when the branch goes that way
+    for (ssa_block_t *dominator = block; dominator->id != 0; dominator = analysis->idom[dominator->id]) {
+        if (dominator->n_predecessors != 1) {
+            continue;
+        }
+
+        ssa_block_t *predecessor = dominator->predecessors[0];
+        ssa_instruction_t *branch = predecessor->instructions[predecessor->n_instructions - 1];
+        if (branch->opcode != SSA_BRANCH || branch->operands[0] == branch->operands[1]) {
+            continue;
+        }
+
+        bool taken = predecessor->successors[0] == dominator;
+        for (size_t o = 0; o < 2; o++) {
+            if (branch->operands[o] != value) {
+                continue;
+            }
+
+            ssa_instruction_t *other = branch->operands[1 - o];
+            struct range_t other_range = analysis->known[other->id] ? analysis->ranges[other->id] : FULL_RANGE;
+
+            // Seen from the right hand side the relation is mirrored
+            char relation = branch->op;
+            if (o == 1 && relation != '=') {
+                relation = relation == '<' ? '>' : '<';
+            }
+            range = narrow_by_relation(range, relation, other_range, taken);
+        }
+    }
+    return range;
+}
+
+static int64_t all_bits_below(int64_t value) {
+    int64_t mask = 0;
+    while (mask < value) {
+        mask = mask * 2 + 1;
+    }
+    return mask;
+}
+
+/**Finds the range of the result of a binary operator from the ranges of
+ * its operands */
+static struct range_t binary_range(char op, struct range_t lhs, struct range_t rhs) {
+    int64_t corners[4];
+    bool overflow = false;
+
+    switch (op) {
+        case '+':
+            overflow |= __builtin_add_overflow(lhs.min, rhs.min, &corners[0]);
+            overflow |= __builtin_add_overflow(lhs.max, rhs.max, &corners[1]);
+            return overflow ? FULL_RANGE : (struct range_t){corners[0], corners[1]};
+        case '-':
+            overflow |= __builtin_sub_overflow(lhs.min, rhs.max, &corners[0]);
+            overflow |= __builtin_sub_overflow(lhs.max, rhs.min, &corners[1]);
+            return overflow ? FULL_RANGE : (struct range_t){corners[0], corners[1]};
+        case '*':
+            overflow |= __builtin_mul_overflow(lhs.min, rhs.min, &corners[0]);
+            overflow |= __builtin_mul_overflow(lhs.min, rhs.max, &corners[1]);
+            overflow |= __builtin_mul_overflow(lhs.max, rhs.min, &corners[2]);
+            overflow |= __builtin_mul_overflow(lhs.max, rhs.max, &corners[3]);
+            break;
+        case '/':
+            if (rhs.min <= 0 && rhs.max >= 0) {
+                // The quotient is never further from zero than the dividend
+                if (lhs.min == INT64_MIN) {
+                    return FULL_RANGE;
+                }
+                int64_t magnitude = MAX(-lhs.min, lhs.max);
+                return (struct range_t){-magnitude, magnitude};
+            }
+
+            if (lhs.min == INT64_MIN && rhs.min <= -1 && rhs.max >= -1) {
+                return FULL_RANGE;
+            }
+            corners[0] = lhs.min / rhs.min;
+            corners[1] = lhs.min / rhs.max;
+            corners[2] = lhs.max / rhs.min;
+            corners[3] = lhs.max / rhs.max;
+            break;
+        case '&':
+            if (lhs.min >= 0 || rhs.min >= 0) {
+                int64_t max = lhs.min >= 0 && rhs.min >= 0 ? MIN(lhs.max, rhs.max)
+                                                            : lhs.min >= 0 ? lhs.max : rhs.max;
+                return (struct range_t){0, max};
+            }
+            return FULL_RANGE;
+        case '|':
+        case '^':
+            if (lhs.min >= 0 && rhs.min >= 0) {
+                int64_t min = op == '|' ? MAX(lhs.min, rhs.min) : 0;
+                return (struct range_t){min, all_bits_below(MAX(lhs.max, rhs.max))};
+            }
+            return FULL_RANGE;
+        case '>':
+            if (lhs.min >= 0 && rhs.min == rhs.max && rhs.min >= 0 && rhs.min < 64) {
+                return (struct range_t){lhs.min >> rhs.min, lhs.max >> rhs.min};
+            }
+            return FULL_RANGE;
+        default:
+            return FULL_RANGE;
+    }
+
+    if (overflow) {
+        return FULL_RANGE;
+    }
+
+    struct range_t range = {corners[0], corners[0]};
+    for (size_t i = 1; i < 4; i++) {
+        range.min = MIN(range.min, corners[i]);
+        range.max = MAX(range.max, corners[i]);
+    }
+    return range;
+}
+
+/**Finds the range of an instruction from the ranges of its operands
+ * @param analysis the state of the analysis
+ * @param instruction the instruction
+ * @param range filled with the range
+ * @return false if the range is not known yet, which is the case for phis
+ *         none of whose operands have been reached */
+static bool instruction_range(struct range_analysis_t *analysis, ssa_instruction_t *instruction, struct range_t *range) {
+    ssa_block_t *block = instruction->block;
+    struct range_t operand;
+
+    switch (instruction->opcode) {
+        case SSA_CONSTANT:
+            *range = (struct range_t){instruction->constant, instruction->constant};
+            return true;
+        case SSA_UNARY:
+            operand = range_in_block(analysis, instruction->operands[0], block);
+            if (instruction->op == '~') {
+                *range = (struct range_t){~operand.max, ~operand.min};
+            } else if (operand.min == INT64_MIN) {
+                *range = FULL_RANGE;
+            } else {
+                *range = (struct range_t){-operand.max, -operand.min};
+            }
+            return true;
+        case SSA_BINARY:
+            *range = binary_range(instruction->op, range_in_block(analysis, instruction->operands[0], block),
+                                  range_in_block(analysis, instruction->operands[1], block));
+            return true;
+        case SSA_PHI:
+            break;
+        default:
+            *range = FULL_RANGE;
+            return true;
+    }
+
+    // The values coming in along each edge, as they are at its start
+    bool known = false;
+    for (size_t o = 0; o < instruction->n_operands; o++) {
+        if (!analysis->known[instruction->operands[o]->id]) {
+            continue;
+        }
+
+        operand = range_in_block(analysis, instruction->operands[o], block->predecessors[o]);
+        if (!known) {
+            *range = operand;
+            known = true;
+        } else {
+            range->min = MIN(range->min, operand.min);
+            range->max = MAX(range->max, operand.max);
+        }
+    }
+    return known;
+}
+
+/**Recomputes the ranges of all instructions once
+ * @param analysis the state of the analysis
+ * @param ssa the function
+ * @param widen if the range of a phi may only grow, and is widened when it
+ *              has grown too many times. Otherwise the phi is narrowed
+ * @return true if any range changed */
+static bool update_ranges(struct range_analysis_t *analysis, ssa_function_t *ssa, bool widen) {
+    bool changed = false;
+
+    for (size_t b = 0; b < ssa->n_blocks; b++) {
+        ssa_block_t *block = ssa->blocks[b];
+        for (size_t i = 0; i < block->n_instructions; i++) {
+            ssa_instruction_t *instruction = block->instructions[i];
+            struct range_t range;
+            if (!ssa_has_value(instruction) || !instruction_range(analysis, instruction, &range)) {
+                continue;
+            }
+
+            size_t id = instruction->id;
+            struct range_t old = analysis->ranges[id];
+            if (instruction->opcode == SSA_PHI && analysis->known[id]) {
+                if (widen) {
+                    range.min = MIN(range.min, old.min);
+                    range.max = MAX(range.max, old.max);
+                    if (range.min != old.min || range.max != old.max) {
+                        if (++analysis->growth[id] > RANGE_GROWTH_LIMIT) {
+                            range.min = range.min < old.min ? INT64_MIN : range.min;
+                            range.max = range.max > old.max ? INT64_MAX : range.max;
+                        }
+                    }
+                } else {
+                    range.min = MAX(range.min, old.min);
+                    range.max = MIN(range.max, old.max);
+                }
+            }
+
+            if (!analysis->known[id] || range.min != old.min || range.max != old.max) {
+                analysis->ranges[id] = range;
+                analysis->known[id] = true;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+static int power_of_two_log2(ssa_instruction_t *value) {
+    if (value->opcode != SSA_CONSTANT || value->constant < 2 || (value->constant & (value->constant - 1)) != 0) {
+        return -1;
+    }
+
+    int log2 = 0;
+    while ((INT64_C(1) << log2) != value->constant) {
+        log2++;
+    }
+    return log2;
+}
+
+/**Picks a cheaper way to divide when the operands allow it
+ * @param analysis the state of the analysis
+ * @param division the division */
+static void specialize_division(struct range_analysis_t *analysis, ssa_instruction_t *division) {
+    ssa_block_t *block = division->block;
+    struct range_t dividend = range_in_block(analysis, division->operands[0], block);
+    struct range_t divisor = range_in_block(analysis, division->operands[1], block);
+
+    if (divisor.min == 1 && divisor.max == 1) {
+        division->replacement = division->operands[0];
+        return;
+    }
+
+    // Without a sign to take care of, dividing by a power of two only
+    // shifts the bits out
+    int shift = power_of_two_log2(division->operands[1]);
+    if (shift > 0 && dividend.min >= 0) {
+        ssa_instruction_t *constant = ssa_create_instruction(SSA_CONSTANT, 0);
+        constant->constant = shift;
+
+        size_t position = 0;
+        while (block->instructions[position] != division) {
+            position++;
+        }
+        ssa_insert_instruction(block, constant, position);
+
+        division->op = '>';
+        division->operands[1] = constant;
+        return;
+    }
+
+    // A 32 bit division is several times faster than one of 128 bits by 64.
+    // A zero divisor traps either way
+    division->narrow = dividend.min >= 0 && dividend.max <= UINT32_MAX && divisor.min >= 0 &&
+                       divisor.max <= UINT32_MAX;
+}
+
+/**Finds which way a branch goes if it always goes the same way
+ * @param analysis the state of the analysis
+ * @param branch the branch
+ * @return the index of the successor it always goes to, or -1 */
+static int known_branch_outcome(struct range_analysis_t *analysis, ssa_instruction_t *branch) {
+    ssa_block_t *block = branch->block;
+    struct range_t lhs = range_in_block(analysis, branch->operands[0], block);
+    struct range_t rhs = range_in_block(analysis, branch->operands[1], block);
+
+    switch (branch->op) {
+        case '<':
+            return lhs.max < rhs.min ? 0 : lhs.min >= rhs.max ? 1 : -1;
+        case '>':
+            return lhs.min > rhs.max ? 0 : lhs.max <= rhs.min ? 1 : -1;
+        case '=':
+            if (lhs.min == lhs.max && rhs.min == rhs.max && lhs.min == rhs.min) {
+                return 0;
+            }
+            return lhs.max < rhs.min || lhs.min > rhs.max ? 1 : -1;
+        default:
+            return -1;
+    }
+}
+
+void propagate_value_ranges(ssa_function_t *ssa) {
+    ssa_block_t *idom[ssa->n_blocks];
+    find_dominators(ssa, idom);
+
+    struct range_t ranges[ssa->n_values + 1];
+    bool known[ssa->n_values + 1];
+    unsigned int growth[ssa->n_values + 1];
+    memset(known, 0, sizeof(known));
+    memset(growth, 0, sizeof(growth));
+    struct range_analysis_t analysis = {.idom = idom, .ranges = ranges, .known = known, .growth = growth};
+
+    while (update_ranges(&analysis, ssa, true)) {
+    }
+    for (int pass = 0; pass < RANGE_NARROWING_PASSES; pass++) {
+        update_ranges(&analysis, ssa, false);
+    }
+
+    // The instructions are changed only once all ranges are known, since
+    // the ranges are kept by value id
+    bool folded = false;
+    for (size_t b = 0; b < ssa->n_blocks; b++) {
+        ssa_block_t *block = ssa->blocks[b];
+        size_t n_instructions = block->n_instructions;
+        ssa_instruction_t *instructions[n_instructions];
+        memcpy(instructions, block->instructions, n_instructions * sizeof(ssa_instruction_t *));
+
+        for (size_t i = 0; i < n_instructions; i++) {
+            ssa_instruction_t *instruction = instructions[i];
+            if (instruction->opcode == SSA_BINARY && instruction->op == '/') {
+                specialize_division(&analysis, instruction);
+            }
+        }
+
+        ssa_instruction_t *terminator = instructions[n_instructions - 1];
+        int outcome = terminator->opcode == SSA_BRANCH ? known_branch_outcome(&analysis, terminator) : -1;
+        if (outcome != -1) {
+            ssa_remove_edge(block, 1 - outcome);
+            terminator->opcode = SSA_JUMP;
+            terminator->n_operands = 0;
+            folded = true;
+        }
+    }
+
+    // Blocks only reached through the branches that were removed go away,
+    // along with the phis that no longer join anything
+    if (folded) {
+        ssa_clean_up(ssa);
+    } else {
+        ssa_apply_replacements(ssa);
+    }
+}
@@ -3,6 +3,9 @@
 static void node_print ( node_t *root, int nesting );
 static void simplify_tree ( node_t **simplified, node_t *root );
 static void node_finalize ( node_t *discard );
+static node_t *rewrite ( node_t *root );
+static bool is_number ( node_t *node, int64_t value );
+static void destroy_rewrite_rules ( void );
 
 typedef struct stem_t *stem;
 struct stem_t { const char *str; stem next; };
@@ -10,14 +13,12 @@ static void
 tree_print(node_t* root, stem head);
 
 
-static void destroy_subtree ( node_t *discard );
-
-
 /* External interface */
 void
 destroy_syntax_tree ( void )
 {
     destroy_subtree ( root );
+    destroy_rewrite_rules ();
 }
 
 
@@ -28,6 +29,23 @@ simplify_syntax_tree ( void )
 }
 
 
+void
+fold_subtree ( node_t **slot )
+{
+    node_t *root = *slot;
+    if ( root == NULL )
+        return;
+
+    for ( uint64_t i=0; i<root->n_children; i++ )
+        fold_subtree ( &root->children[i] );
+
+    /* The rules for the structure of the parse tree don't apply here */
+    if ( root->type == EXPRESSION ||
+         root->type == IF_STATEMENT || root->type == WHILE_STATEMENT )
+        *slot = rewrite ( root );
+}
+
+
 extern bool new_print_style;
 void
 print_syntax_tree ( void )
@@ -139,7 +157,7 @@ node_finalize ( node_t *discard )
 }
 
 
-static void
+void
 destroy_subtree ( node_t *discard )
 {
     if ( discard != NULL )
@@ -151,6 +169,30 @@ destroy_subtree ( node_t *discard )
 }
 
 
+bool
+is_call ( node_t *node )
+{
+    return node->type == EXPRESSION && node->data == NULL && node->n_children == 2;
+}
+
+
+bool
+is_assignment ( node_t *node )
+{
+    switch ( node->type )
+    {
+        case ASSIGNMENT_STATEMENT:
+        case ADD_STATEMENT:
+        case SUBTRACT_STATEMENT:
+        case MULTIPLY_STATEMENT:
+        case DIVIDE_STATEMENT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+
 static void
 simplify_tree ( node_t **simplified, node_t *root )
 {
@@ -161,73 +203,923 @@ simplify_tree ( node_t **simplified, node_t *root )
     for ( uint64_t i=0; i<root->n_children; i++ )
         simplify_tree ( &root->children[i], root->children[i] );
 
-    node_t *discard, *result = root;
-    switch ( root->type )
+    /* Dividing by a constant zero is left for the program to run into */
+    if ( root->type == EXPRESSION && root->n_children == 2 &&
+         root->data != NULL && *((char *)root->data) == '/' &&
+         is_number ( root->children[1], 0 )
+    )
+        fprintf ( stderr, "Warning: division by zero\n" );
+
+    *simplified = rewrite ( root );
+}
+
+
+/* Constant folding and algebraic identities.
+ * Arithmetic wraps around like the machine instructions it replaces do.
+ * Divisions that would trap are left for the program to run into, and
+ * operands are only dropped when evaluating them can't have side effects.
+ */
+static node_t *
+number_node ( int64_t value )
+{
+    node_t *number = malloc ( sizeof(node_t) );
+    int64_t *data = malloc ( sizeof(int64_t) );
+    *data = value;
+    node_init ( number, NUMBER_DATA, data, 0 );
+    return number;
+}
+
+
+static bool
+is_number ( node_t *node, int64_t value )
+{
+    return node->type == NUMBER_DATA && *((int64_t *)node->data) == value;
+}
+
+
+static bool
+has_side_effects ( node_t *node )
+{
+    if ( is_call ( node ) )
+        return true;
+    for ( uint64_t i=0; i<node->n_children; i++ )
+        if ( has_side_effects ( node->children[i] ) )
+            return true;
+    return false;
+}
+
+
+/* Checks if two pure expressions always have the same value. Names are
+ * not bound yet, but the same name within one expression is the same
+ * variable */
+static bool
+same_value ( node_t *a, node_t *b )
+{
+    if ( a->type != b->type || a->n_children != b->n_children )
+        return false;
+    switch ( a->type )
     {
-        /* Structures of purely syntactic function */
-        case PARAMETER_LIST: case ARGUMENT_LIST:
-        case STATEMENT: case PRINT_ITEM: case GLOBAL:
-            result = root->children[0];
-            node_finalize ( root );
-            break;
-        case PRINT_STATEMENT:
-            result = root->children[0];
-            result->type = PRINT_STATEMENT;
-            node_finalize(root);
+        case NUMBER_DATA:
+            return *((int64_t *)a->data) == *((int64_t *)b->data);
+        case IDENTIFIER_DATA:
+            return !strcmp ( a->data, b->data );
+        case EXPRESSION:
+            if ( a->data == NULL || b->data == NULL || strcmp ( a->data, b->data ) )
+                return false;
             break;
-        /* Flatten lists:
-         * Take left child, append right child, substitute left for root.
-         */
-        case STATEMENT_LIST: case DECLARATION_LIST: case GLOBAL_LIST:
-        case PRINT_LIST: case EXPRESSION_LIST: case VARIABLE_LIST:
-            if ( root->n_children >= 2 )
-            {
-                result = root->children[0];
-                result->n_children += 1;
-                result->children = realloc (
-                    result->children, result->n_children * sizeof(node_t *)
-                );
-                result->children[result->n_children-1] = root->children[1];
-                node_finalize ( root );
-            }
+        default:
+            return false;
+    }
+    for ( uint64_t i=0; i<a->n_children; i++ )
+        if ( !same_value ( a->children[i], b->children[i] ) )
+            return false;
+    return true;
+}
+
+
+/* Replaces an expression by one of its children, dropping the others */
+static node_t *
+keep_child ( node_t *root, uint64_t keep )
+{
+    node_t *result = root->children[keep];
+    for ( uint64_t i=0; i<root->n_children; i++ )
+        if ( i != keep )
+            destroy_subtree ( root->children[i] );
+    node_finalize ( root );
+    return result;
+}
+
+
+static node_t *
+replace_by_number ( node_t *root, int64_t value )
+{
+    destroy_subtree ( root );
+    return number_node ( value );
+}
+
+
+/* Computes x op y, returns false if the machine would trap */
+bool
+fold_constants ( char op, int64_t x, int64_t y, int64_t *result )
+{
+    uint64_t ux = x, uy = y;
+    switch ( op )
+    {
+        case '|': *result = x | y; break;
+        case '^': *result = x ^ y; break;
+        case '&': *result = x & y; break;
+        case '+': *result = (int64_t) (ux + uy); break;
+        case '-': *result = (int64_t) (ux - uy); break;
+        case '*': *result = (int64_t) (ux * uy); break;
+        case '/':
+            if ( y == 0 || (x == INT64_MIN && y == -1) )
+                return false;
+            *result = x / y;
             break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+
+/* The constant that leaves the other operand of an operator as it is */
+static int64_t
+identity_element ( char op )
+{
+    switch ( op )
+    {
+        case '*': return 1;
+        case '&': return -1;
+        default:  return 0;
+    }
+}
+
+
+/* Canonical order of the operands of an associative operator */
+static int
+compare_subtrees ( const void *pa, const void *pb )
+{
+    node_t *a = *(node_t * const *)pa, *b = *(node_t * const *)pb;
+    if ( a->type != b->type )
+        return a->type < b->type ? -1 : 1;
+    switch ( a->type )
+    {
+        case NUMBER_DATA:
+        {
+            int64_t x = *((int64_t *)a->data), y = *((int64_t *)b->data);
+            return x < y ? -1 : x > y;
+        }
+        case IDENTIFIER_DATA:
+            return strcmp ( a->data, b->data );
         case EXPRESSION:
-            switch ( root->n_children )
+            if ( a->data != NULL && b->data != NULL && strcmp ( a->data, b->data ) )
+                return strcmp ( a->data, b->data );
+            break;
+        default:
+            break;
+    }
+    if ( a->n_children != b->n_children )
+        return a->n_children < b->n_children ? -1 : 1;
+    for ( uint64_t i=0; i<a->n_children; i++ )
+    {
+        int order = compare_subtrees ( &a->children[i], &b->children[i] );
+        if ( order != 0 )
+            return order;
+    }
+    return 0;
+}
+
+
+/* The operands of a chain of one associative operator */
+typedef struct {
+    char op;
+    node_t **operands;
+    size_t n_operands, capacity;
+    /* All constant operands folded into one */
+    int64_t constant;
+} operand_list_t;
+
+
+/* Collects the operands of a chain of operators, freeing its nodes and
+ * the constants along the way. Subtracting a constant counts as adding
+ * its negation */
+static void
+collect_operands ( node_t *node, operand_list_t *list )
+{
+    bool chained = node->type == EXPRESSION && node->n_children == 2 &&
+        node->data != NULL && *((char *)node->data) == list->op;
+    bool subtracts_constant = list->op == '+' && node->type == EXPRESSION &&
+        node->n_children == 2 && node->data != NULL &&
+        *((char *)node->data) == '-' && node->children[1]->type == NUMBER_DATA;
+
+    if ( chained || subtracts_constant )
+    {
+        if ( subtracts_constant )
+        {
+            int64_t *value = node->children[1]->data;
+            *value = (int64_t) (0 - (uint64_t) *value);
+        }
+        collect_operands ( node->children[0], list );
+        collect_operands ( node->children[1], list );
+        node_finalize ( node );
+        return;
+    }
+
+    if ( node->type == NUMBER_DATA )
+    {
+        fold_constants (
+            list->op, list->constant, *((int64_t *)node->data), &list->constant
+        );
+        destroy_subtree ( node );
+        return;
+    }
+
+    if ( list->n_operands == list->capacity )
+    {
+        list->capacity = list->capacity == 0 ? 4 : list->capacity * 2;
+        list->operands = realloc (
+            list->operands, list->capacity * sizeof(node_t *)
+        );
+    }
+    list->operands[list->n_operands++] = node;
+}
+
+
+static node_t *
+binary_node ( char op, node_t *x, node_t *y )
+{
+    node_t *node = malloc ( sizeof(node_t) );
+    char name[2] = { op, '\0' };
+    node_init ( node, EXPRESSION, strdup ( name ), 2, x, y );
+    return node;
+}
+
+
+/* Flattens a chain of an associative operator, folds its constants into
+ * one which is put last, where it can be an immediate operand, and sorts
+ * the other operands into a canonical order. Operands are evaluated right
+ * to left whatever the shape of the chain, so their order is kept if any
+ * of them have side effects */
+static node_t *
+reassociate ( node_t *root )
+{
+    char op = *((char *)root->data);
+    operand_list_t list = {
+        .op = op == '-' ? '+' : op,
+        .operands = NULL, .n_operands = 0, .capacity = 0,
+        .constant = identity_element ( op )
+    };
+    collect_operands ( root, &list );
+
+    bool pure = true;
+    for ( size_t i=0; i<list.n_operands; i++ )
+        pure = pure && !has_side_effects ( list.operands[i] );
+
+    if ( pure )
+    {
+        qsort ( list.operands, list.n_operands, sizeof(node_t *), compare_subtrees );
+
+        /* x & x and x | x are x, x ^ x cancels out */
+        size_t kept = 0;
+        for ( size_t i=0; i<list.n_operands; i++ )
+        {
+            bool duplicate = kept > 0 && (list.op == '&' || list.op == '|' ||
+                list.op == '^') && same_value ( list.operands[kept-1], list.operands[i] );
+            if ( !duplicate )
+                list.operands[kept++] = list.operands[i];
+            else
             {
-                case 1:
-                    if ( root->children[0]->type == NUMBER_DATA )
-                    {
-                        result = root->children[0];
-                        if ( root->data != NULL )
-                            *((int64_t *)result->data) *= -1;
-                        node_finalize (root);
-                    }
-                    else if ( root->data == NULL )
-                    {
-                        result = root->children[0];
-                        node_finalize (root);
-                    }
-                    break;
-                case 2:
-                    if ( root->children[0]->type == NUMBER_DATA &&
-                         root->children[1]->type == NUMBER_DATA
-                    ) {
-                        result = root->children[0];
-                        int64_t
-                            *x = result->data,
-                            *y = root->children[1]->data;
-                        switch ( *((char *)root->data) )
-                        {
-                            case '+': *x += *y; break;
-                            case '-': *x -= *y; break;
-                            case '*': *x *= *y; break;
-                            case '/': *x /= *y; break;
-                        }
-                        node_finalize ( root->children[1] );
-                        node_finalize ( root );
-                    }
-                    break;
+                destroy_subtree ( list.operands[i] );
+                if ( list.op == '^' )
+                    destroy_subtree ( list.operands[--kept] );
             }
+        }
+        list.n_operands = kept;
+    }
+
+    node_t *result = NULL;
+    for ( size_t i=0; i<list.n_operands; i++ )
+        result = result == NULL ? list.operands[i]
+            : binary_node ( list.op, result, list.operands[i] );
+    free ( list.operands );
+
+    if ( result == NULL )
+        return number_node ( list.constant );
+    if ( list.constant == identity_element ( list.op ) )
+        return result;
+    if ( list.op == '+' && list.constant < 0 && list.constant != INT64_MIN )
+        return binary_node ( '-', result, number_node ( -list.constant ) );
+    return binary_node ( list.op, result, number_node ( list.constant ) );
+}
+
+
+/* Finds the outcome of a relation known at compile time:
+ * 1 if it always holds, 0 if it never does, -1 if it is not known */
+static int
+relation_outcome ( node_t *relation )
+{
+    node_t *x = relation->children[0], *y = relation->children[1];
+    char op = *((char *)relation->data);
+
+    if ( x->type == NUMBER_DATA && y->type == NUMBER_DATA )
+    {
+        int64_t a = *((int64_t *)x->data), b = *((int64_t *)y->data);
+        switch ( op )
+        {
+            case '=': return a == b;
+            case '<': return a < b;
+            case '>': return a > b;
+        }
+    }
+
+    if ( !has_side_effects ( x ) && !has_side_effects ( y ) && same_value ( x, y ) )
+        return op == '=';
+    return -1;
+}
+
+
+/* Replaces if- and while-statements whose relation is known by the
+ * statement that is run, if any. Returns NULL if it is not known */
+static node_t *
+fold_conditional ( node_t *root )
+{
+    int outcome = relation_outcome ( root->children[0] );
+
+    /* A loop that is always entered has to stay a loop */
+    if ( outcome == -1 || (root->type == WHILE_STATEMENT && outcome == 1) )
+        return NULL;
+
+    if ( outcome == 1 )
+        return keep_child ( root, 1 );
+    if ( root->n_children == 3 )
+        return keep_child ( root, 2 );
+
+    node_t *empty = malloc ( sizeof(node_t) );
+    node_init ( empty, STATEMENT_LIST, NULL, 0 );
+    destroy_subtree ( root );
+    return empty;
+}
+
+
+/* Rewrite rules for simplify_tree, tried in order on each node once its
+ * children are simplified. A rule reads  pattern -> replacement.
+ *
+ * A pattern is a node type, followed by an operator in quotes if the node
+ * has one ('?' for any operator) and by patterns for the children in
+ * parentheses, which are not looked at if left out. Patterns for children
+ * can also be a number, #a for any number, a lower case name for any
+ * subtree, or _ for anything at all. A name used twice matches the same
+ * value twice, and "name : pattern" names a node matching the pattern.
+ *
+ * The replacement is one of the names in the pattern, a number, a unary
+ * operator applied to a name, a name followed by ": TYPE" to change the
+ * type of its node, or an @action computing the result in C. Named
+ * subtrees that are not kept must not have side effects for the rule to
+ * apply, _ is for parts that are never evaluated.
+ */
+static const char *rule_text[] = {
+    /* Structures of purely syntactic function */
+    "PARAMETER_LIST(x) -> x",
+    "ARGUMENT_LIST(x) -> x",
+    "STATEMENT(x) -> x",
+    "PRINT_ITEM(x) -> x",
+    "GLOBAL(x) -> x",
+    "PRINT_STATEMENT(x : PRINT_LIST) -> x : PRINT_STATEMENT",
+
+    /* Flatten lists: append the right child to the left one */
+    "STATEMENT_LIST(STATEMENT_LIST, _) -> @append",
+    "DECLARATION_LIST(DECLARATION_LIST, _) -> @append",
+    "GLOBAL_LIST(GLOBAL_LIST, _) -> @append",
+    "PRINT_LIST(PRINT_LIST, _) -> @append",
+    "EXPRESSION_LIST(EXPRESSION_LIST, _) -> @append",
+    "VARIABLE_LIST(VARIABLE_LIST, _) -> @append",
+
+    /* Parentheses, numbers and names in expressions */
+    "EXPRESSION(x) -> x",
+
+    /* Constants */
+    "EXPRESSION '?'(#a) -> @fold",
+    "EXPRESSION '?'(#a, #b) -> @fold",
+    "EXPRESSION '-'(EXPRESSION '-'(x)) -> x",
+    "EXPRESSION '~'(EXPRESSION '~'(x)) -> x",
+
+    /* Chains of associative operators */
+    "EXPRESSION '+'(_, _) -> @reassociate",
+    "EXPRESSION '-'(_, #a) -> @reassociate",
+    "EXPRESSION '*'(_, _) -> @reassociate",
+    "EXPRESSION '&'(_, _) -> @reassociate",
+    "EXPRESSION '|'(_, _) -> @reassociate",
+    "EXPRESSION '^'(_, _) -> @reassociate",
+
+    /* Algebraic identities */
+    "EXPRESSION '+'(x, 0) -> x",
+    "EXPRESSION '+'(0, x) -> x",
+    "EXPRESSION '-'(x, 0) -> x",
+    "EXPRESSION '-'(0, x) -> -x",
+    "EXPRESSION '-'(x, x) -> 0",
+    "EXPRESSION '*'(x, 1) -> x",
+    "EXPRESSION '*'(1, x) -> x",
+    "EXPRESSION '*'(x, 0) -> 0",
+    "EXPRESSION '*'(0, x) -> 0",
+    "EXPRESSION '*'(x, -1) -> -x",
+    "EXPRESSION '*'(-1, x) -> -x",
+    "EXPRESSION '/'(x, 1) -> x",
+    "EXPRESSION '&'(x, 0) -> 0",
+    "EXPRESSION '&'(0, x) -> 0",
+    "EXPRESSION '&'(x, -1) -> x",
+    "EXPRESSION '&'(-1, x) -> x",
+    "EXPRESSION '&'(x, x) -> x",
+    "EXPRESSION '|'(x, -1) -> -1",
+    "EXPRESSION '|'(-1, x) -> -1",
+    "EXPRESSION '|'(x, 0) -> x",
+    "EXPRESSION '|'(0, x) -> x",
+    "EXPRESSION '|'(x, x) -> x",
+    "EXPRESSION '^'(x, 0) -> x",
+    "EXPRESSION '^'(0, x) -> x",
+    "EXPRESSION '^'(x, x) -> 0",
+    "EXPRESSION '^'(x, -1) -> ~x",
+    "EXPRESSION '^'(-1, x) -> ~x",
+
+    /* If- and while-statements whose relation is known */
+    "IF_STATEMENT -> @decide",
+    "WHILE_STATEMENT -> @decide"
+};
+
+#define N_RULES (sizeof(rule_text) / sizeof(rule_text[0]))
+#define N_NODE_TYPES (STRING_DATA + 1)
+#define N_NAMES 26
+
+/* Operators of expressions and relations. Rules are looked up by node
+ * type and operator, where slot 0 is for nodes without one */
+static const char operators[] = "|^&+-*/~=<>";
+#define N_OPERATOR_SLOTS (sizeof(operators))
+
+typedef enum {
+    PATTERN_ANY, PATTERN_NAME, PATTERN_NUMBER, PATTERN_ANY_NUMBER, PATTERN_NODE
+} pattern_kind_t;
+
+typedef struct pattern {
+    pattern_kind_t kind;
+    char name;
+    int64_t value;
+    node_index_t type;
+    /* '\0' for nodes without an operator, '?' for any operator */
+    char op;
+    /* Negative if the children are not looked at */
+    int64_t n_children;
+    struct pattern *children;
+} pattern_t;
+
+typedef enum {
+    REPLACE_NAME, REPLACE_NUMBER, REPLACE_UNARY, REPLACE_RETYPE, REPLACE_ACTION
+} replacement_kind_t;
+
+typedef struct {
+    const char *text;
+    pattern_t pattern;
+    replacement_kind_t kind;
+    char name, op;
+    int64_t value;
+    node_index_t type;
+    /* Returns NULL if the rule doesn't apply after all */
+    node_t *(*action) ( node_t *root );
+    /* Number of times the rule was applied */
+    size_t hits;
+} rewrite_rule_t;
+
+/* Indices of the rules that may apply to one type and operator, in order */
+typedef struct {
+    size_t *rules;
+    size_t n_rules;
+} rule_list_t;
+
+static rewrite_rule_t *rules = NULL;
+static rule_list_t dispatch[N_NODE_TYPES][N_OPERATOR_SLOTS];
+
+
+static node_t *
+fold_numbers ( node_t *root )
+{
+    char op = *((char *)root->data);
+    int64_t x = *((int64_t *)root->children[0]->data), value;
+
+    if ( root->n_children == 1 )
+        return replace_by_number (
+            root, op == '~' ? ~x : (int64_t) (0 - (uint64_t) x)
+        );
+    if ( !fold_constants ( op, x, *((int64_t *)root->children[1]->data), &value ) )
+        return NULL;
+    return replace_by_number ( root, value );
+}
+
+
+/* Takes left child, appends right child, substitutes left for root */
+static node_t *
+append_to_list ( node_t *root )
+{
+    node_t *result = root->children[0];
+    result->n_children += 1;
+    result->children = realloc (
+        result->children, result->n_children * sizeof(node_t *)
+    );
+    result->children[result->n_children-1] = root->children[1];
+    node_finalize ( root );
+    return result;
+}
+
+
+static const struct {
+    const char *name;
+    node_t *(*apply) ( node_t *root );
+} actions[] = {
+    { "fold", fold_numbers },
+    { "append", append_to_list },
+    { "reassociate", reassociate },
+    { "decide", fold_conditional }
+};
+
+
+/* Reading the rules */
+static void
+rule_error ( const char *text )
+{
+    fprintf ( stderr, "Malformed rewrite rule: %s\n", text );
+    exit ( EXIT_FAILURE );
+}
+
+
+static void
+skip_spaces ( const char **at )
+{
+    while ( **at == ' ' )
+        *at += 1;
+}
+
+
+static bool
+is_name ( char c )
+{
+    return c >= 'a' && c <= 'z';
+}
+
+
+static bool
+read_number ( const char **at, int64_t *value )
+{
+    const char *digits = **at == '-' ? *at + 1 : *at;
+    if ( *digits < '0' || *digits > '9' )
+        return false;
+    char *end;
+    *value = strtol ( *at, &end, 10 );
+    *at = end;
+    return true;
+}
+
+
+static node_index_t
+read_type ( const char *text, const char **at )
+{
+    size_t length = 0;
+    while ( ((*at)[length] >= 'A' && (*at)[length] <= 'Z') || (*at)[length] == '_' )
+        length++;
+    for ( node_index_t type=0; type<N_NODE_TYPES; type++ )
+        if ( strlen ( node_string[type] ) == length &&
+             !strncmp ( node_string[type], *at, length )
+        )
+        {
+            *at += length;
+            return type;
+        }
+    rule_error ( text );
+    return PROGRAM;
+}
+
+
+static void
+read_pattern ( const char *text, const char **at, pattern_t *pattern )
+{
+    skip_spaces ( at );
+    *pattern = (pattern_t) { .kind = PATTERN_NODE, .n_children = -1 };
+
+    if ( **at == '_' )
+    {
+        pattern->kind = PATTERN_ANY;
+        *at += 1;
+    }
+    else if ( **at == '#' && is_name ( (*at)[1] ) )
+    {
+        pattern->kind = PATTERN_ANY_NUMBER;
+        pattern->name = (*at)[1];
+        *at += 2;
+    }
+    else if ( is_name ( **at ) )
+    {
+        char name = **at;
+        *at += 1;
+        skip_spaces ( at );
+        if ( **at == ':' )
+        {
+            *at += 1;
+            read_pattern ( text, at, pattern );
+            if ( pattern->kind != PATTERN_NODE || pattern->name != '\0' )
+                rule_error ( text );
+        }
+        else
+            pattern->kind = PATTERN_NAME;
+        pattern->name = name;
+    }
+    else if ( read_number ( at, &pattern->value ) )
+        pattern->kind = PATTERN_NUMBER;
+    else
+    {
+        pattern->type = read_type ( text, at );
+        skip_spaces ( at );
+        if ( **at == '\'' )
+        {
+            pattern->op = (*at)[1];
+            if ( (*at)[2] != '\'' || pattern->op == '\0' ||
+                 (pattern->op != '?' && strchr ( operators, pattern->op ) == NULL)
+            )
+                rule_error ( text );
+            *at += 3;
+            skip_spaces ( at );
+        }
+        if ( **at == '(' )
+        {
+            pattern->n_children = 0;
+            do {
+                *at += 1;
+                pattern->children = realloc ( pattern->children,
+                    (pattern->n_children + 1) * sizeof(pattern_t)
+                );
+                read_pattern ( text, at, &pattern->children[pattern->n_children++] );
+                skip_spaces ( at );
+            } while ( **at == ',' );
+            if ( **at != ')' )
+                rule_error ( text );
+            *at += 1;
+        }
+    }
+}
+
+
+static bool
+binds_name ( pattern_t *pattern, char name )
+{
+    if ( pattern->name == name )
+        return true;
+    for ( int64_t i=0; i<pattern->n_children; i++ )
+        if ( binds_name ( &pattern->children[i], name ) )
+            return true;
+    return false;
+}
+
+
+static void
+read_rule ( const char *text, rewrite_rule_t *rule )
+{
+    const char *at = text;
+    *rule = (rewrite_rule_t) { .text = text, .hits = 0 };
+
+    read_pattern ( text, &at, &rule->pattern );
+    skip_spaces ( &at );
+    if ( rule->pattern.kind != PATTERN_NODE || strncmp ( at, "->", 2 ) )
+        rule_error ( text );
+    at += 2;
+    skip_spaces ( &at );
+
+    if ( *at == '@' )
+    {
+        rule->kind = REPLACE_ACTION;
+        at += 1;
+        for ( size_t i=0; i<sizeof(actions)/sizeof(actions[0]); i++ )
+            if ( !strcmp ( at, actions[i].name ) )
+                rule->action = actions[i].apply;
+        if ( rule->action == NULL )
+            rule_error ( text );
+        return;
+    }
+
+    if ( read_number ( &at, &rule->value ) )
+        rule->kind = REPLACE_NUMBER;
+    else if ( (*at == '-' || *at == '~') && is_name ( at[1] ) )
+    {
+        rule->kind = REPLACE_UNARY;
+        rule->op = at[0];
+        rule->name = at[1];
+        at += 2;
+    }
+    else if ( is_name ( *at ) )
+    {
+        rule->kind = REPLACE_NAME;
+        rule->name = *at;
+        at += 1;
+        skip_spaces ( &at );
+        if ( *at == ':' )
+        {
+            at += 1;
+            skip_spaces ( &at );
+            rule->kind = REPLACE_RETYPE;
+            rule->type = read_type ( text, &at );
+        }
+    }
+
+    skip_spaces ( &at );
+    if ( *at != '\0' ||
+         (rule->kind != REPLACE_NUMBER && !binds_name ( &rule->pattern, rule->name ))
+    )
+        rule_error ( text );
+}
+
+
+static size_t
+operator_slot ( char op )
+{
+    if ( op == '\0' )
+        return 0;
+    return strchr ( operators, op ) - operators + 1;
+}
+
+
+static void
+add_to_dispatch ( rule_list_t *list, size_t rule )
+{
+    list->rules = realloc ( list->rules, (list->n_rules + 1) * sizeof(size_t) );
+    list->rules[list->n_rules++] = rule;
+}
+
+
+/* Reads the rules and sorts them by the type and operator of the nodes
+ * they apply to, so only the rules that can match a node are tried */
+static void
+compile_rewrite_rules ( void )
+{
+    rules = malloc ( N_RULES * sizeof(rewrite_rule_t) );
+    for ( size_t r=0; r<N_RULES; r++ )
+    {
+        read_rule ( rule_text[r], &rules[r] );
+        pattern_t *pattern = &rules[r].pattern;
+        if ( pattern->op == '?' )
+            for ( size_t slot=1; slot<N_OPERATOR_SLOTS; slot++ )
+                add_to_dispatch ( &dispatch[pattern->type][slot], r );
+        else
+            add_to_dispatch (
+                &dispatch[pattern->type][operator_slot ( pattern->op )], r
+            );
+    }
+}
+
+
+static void
+destroy_pattern ( pattern_t *pattern )
+{
+    for ( int64_t i=0; i<pattern->n_children; i++ )
+        destroy_pattern ( &pattern->children[i] );
+    free ( pattern->children );
+}
+
+
+static void
+destroy_rewrite_rules ( void )
+{
+    if ( rules == NULL )
+        return;
+    for ( size_t r=0; r<N_RULES; r++ )
+        destroy_pattern ( &rules[r].pattern );
+    free ( rules );
+    rules = NULL;
+    for ( size_t type=0; type<N_NODE_TYPES; type++ )
+        for ( size_t slot=0; slot<N_OPERATOR_SLOTS; slot++ )
+        {
+            free ( dispatch[type][slot].rules );
+            dispatch[type][slot] = (rule_list_t) { NULL, 0 };
+        }
+}
+
+
+void
+print_rewrite_statistics ( void )
+{
+    if ( rules == NULL )
+        compile_rewrite_rules ();
+    for ( size_t r=0; r<N_RULES; r++ )
+        fprintf ( stderr, "%8zu  %s\n", rules[r].hits, rules[r].text );
+}
+
+
+/* Applying the rules */
+static char
+node_operator ( node_t *node )
+{
+    if ( (node->type == EXPRESSION || node->type == RELATION) && node->data != NULL )
+        return *((char *)node->data);
+    return '\0';
+}
+
+
+/* Matches the tree in a slot against a pattern, and records the slots
+ * the names in it matched */
+static bool
+match_pattern ( pattern_t *pattern, node_t **slot, node_t ***bindings )
+{
+    node_t *node = *slot;
+    switch ( pattern->kind )
+    {
+        case PATTERN_ANY:
+            return true;
+        case PATTERN_NUMBER:
+            return node != NULL && is_number ( node, pattern->value );
+        case PATTERN_ANY_NUMBER:
+            if ( node == NULL || node->type != NUMBER_DATA )
+                return false;
+            bindings[pattern->name - 'a'] = slot;
+            return true;
+        case PATTERN_NAME:
+            if ( node == NULL )
+                return false;
+            /* The second one is dropped, so it can't have side effects */
+            if ( bindings[pattern->name - 'a'] != NULL )
+                return !has_side_effects ( node ) &&
+                    same_value ( *bindings[pattern->name - 'a'], node );
+            bindings[pattern->name - 'a'] = slot;
+            return true;
+        case PATTERN_NODE:
+            break;
+    }
+
+    if ( node == NULL || node->type != pattern->type )
+        return false;
+    char op = node_operator ( node );
+    if ( pattern->op == '?' ? op == '\0' : op != pattern->op )
+        return false;
+    if ( pattern->n_children >= 0 && node->n_children != (uint64_t) pattern->n_children )
+        return false;
+    for ( int64_t i=0; i<pattern->n_children; i++ )
+        if ( !match_pattern ( &pattern->children[i], &node->children[i], bindings ) )
+            return false;
+    if ( pattern->name != '\0' )
+        bindings[pattern->name - 'a'] = slot;
+    return true;
+}
+
+
+/* Builds the replacement of a matched tree, or returns NULL if the rule
+ * does not apply after all */
+static node_t *
+apply_rule ( rewrite_rule_t *rule, node_t *root, node_t ***bindings )
+{
+    if ( rule->kind == REPLACE_ACTION )
+        return rule->action ( root );
+
+    for ( int n=0; n<N_NAMES; n++ )
+        if ( bindings[n] != NULL && n != rule->name - 'a' &&
+             has_side_effects ( *bindings[n] )
+        )
+            return NULL;
+
+    node_t *kept = NULL;
+    if ( rule->kind != REPLACE_NUMBER )
+    {
+        kept = *bindings[rule->name - 'a'];
+        *bindings[rule->name - 'a'] = NULL;
+    }
+    destroy_subtree ( root );
+
+    node_t *result = kept;
+    char name[2] = { rule->op, '\0' };
+    switch ( rule->kind )
+    {
+        case REPLACE_NUMBER:
+            result = number_node ( rule->value );
+            break;
+        case REPLACE_UNARY:
+            result = malloc ( sizeof(node_t) );
+            node_init ( result, EXPRESSION, strdup ( name ), 1, kept );
+            break;
+        case REPLACE_RETYPE:
+            result->type = rule->type;
+            break;
+        default:
+            break;
+    }
+    return result;
+}
+
+
+/* Rewrites a node whose children are rewritten already, until no rule
+ * applies to it. Each rule is applied at most once to a node, which keeps
+ * rules that normalize, like the reassociation, from going around in
+ * circles. A subtree that is kept as it is needs no more rewriting */
+static node_t *
+rewrite ( node_t *root )
+{
+    if ( rules == NULL )
+        compile_rewrite_rules ();
+
+    bool applied[N_RULES] = { false };
+    rule_list_t *candidates =
+        &dispatch[root->type][operator_slot ( node_operator ( root ) )];
+
+    size_t i = 0;
+    while ( i < candidates->n_rules )
+    {
+        size_t r = candidates->rules[i++];
+        node_t **bindings[N_NAMES] = { NULL }, *result;
+        if ( applied[r] || !match_pattern ( &rules[r].pattern, &root, bindings ) ||
+             (result = apply_rule ( &rules[r], root, bindings )) == NULL
+        )
+            continue;
+
+        rules[r].hits++;
+        applied[r] = true;
+        root = result;
+        if ( rules[r].kind == REPLACE_NAME )
+            break;
+
+        /* Start over with the rules for what the node became */
+        candidates = &dispatch[root->type][operator_slot ( node_operator ( root ) )];
+        i = 0;
     }
-    *simplified = result;
+    return root;
 }
@@ -14,12 +14,78 @@ size_t stringc = 0;         // Initial string count
 
 /* Command line option parsing for the main function */
 static void options ( int argc, char **argv );
+static void set_optimization_flag ( char *name );
 bool
     print_full_tree = false,
     print_simplified_tree = false,
     print_symbol_table_contents = false,
+    print_rewrite_counts = false,
+    print_ssa = false,
     print_generated_program = true,
-    new_print_style = true;
+    new_print_style = true,
+    omit_frame_pointer = false,
+    if_conversion = true,
+    private_calls = false,
+    promote_globals = true,
+    peephole = true,
+    simplify_cfg = true,
+    use_ssa = false,
+    global_value_numbering = true,
+    value_range_propagation = true,
+    constant_propagation = true,
+    interprocedural_constants = true,
+    evaluate_calls = true,
+    memoize = false,
+    memoize_stats = false,
+    unroll_loops = true,
+    strength_reduction = true,
+    closed_form_loops = true;
+int
+    loop_alignment = 16,
+    if_conversion_limit = 4,
+    specialization_budget = 500,
+    evaluation_steps = 100000,
+    evaluation_depth = 100,
+    unroll_factor = 4,
+    unroll_limit = 24;
+
+/* Optimizations that can be turned on with -f<name> and off with -fno-<name> */
+static struct {
+    const char *name;
+    bool *enabled;
+} optimization_flags[] = {
+    { "omit-frame-pointer", &omit_frame_pointer },
+    { "if-conversion", &if_conversion },
+    { "private-calls", &private_calls },
+    { "promote-globals", &promote_globals },
+    { "peephole", &peephole },
+    { "simplify-cfg", &simplify_cfg },
+    { "ssa", &use_ssa },
+    { "gvn", &global_value_numbering },
+    { "vrp", &value_range_propagation },
+    { "constant-propagation", &constant_propagation },
+    { "ipa-cp", &interprocedural_constants },
+    { "evaluate-calls", &evaluate_calls },
+    { "memoize", &memoize },
+    { "memoize-stats", &memoize_stats },
+    { "unroll-loops", &unroll_loops },
+    { "strength-reduction", &strength_reduction },
+    { "closed-form-loops", &closed_form_loops }
+};
+
+/* Parameters of optimizations, set with -f<name>=<value> */
+static struct {
+    const char *name;
+    int *value;
+} optimization_parameters[] = {
+    { "align-loops", &loop_alignment },
+    { "if-conversion-limit", &if_conversion_limit },
+    { "ipa-cp-budget", &specialization_budget },
+    { "eval-steps", &evaluation_steps },
+    { "eval-depth", &evaluation_depth },
+    { "unroll-factor", &unroll_factor },
+    { "unroll-limit", &unroll_limit }
+};
 
 
 /* Entry point */
@@ -40,9 +106,14 @@ main ( int argc, char **argv )
     if ( print_symbol_table_contents )
         print_symbol_table();
 
+    optimize_syntax_tree ();  // In optimizer.c
+    if ( print_ssa )
+        print_ssa_program ();   // In ssa.c
+
     if ( print_generated_program )
         generate_program ();    // In generator.c
-
+    if ( print_rewrite_counts )
+        print_rewrite_statistics ();    // In tree.c
 
     destroy_syntax_tree ();     // In tree.c
     destroy_symbol_table ();    // In ir.c
@@ -55,15 +126,109 @@ static const char *usage =
 "\t-t\tOutput the full syntax tree\n"
 "\t-T\tOutput the simplified syntax tree\n"
 "\t-s\tOutput the symbol table contents\n"
+"\t-r\tOutput how many times each tree rewrite rule was applied\n"
+"\t-i\tOutput the SSA form of the functions\n"
 "\t-q\tQuiet: suppress output from the code generator\n"
-"\t-u\tDo not use print style more like the tree command\n";
+"\t-u\tDo not use print style more like the tree command\n"
+"\t-f<opt>\tEnable an optimization, -fno-<opt> disables it. Available:\n"
+"\t\tomit-frame-pointer\tAddress frames relative to %rsp (off)\n"
+"\t\tif-conversion\tUse conditional moves for if-statements that\n"
+"\t\t\t\tonly pick the value of a variable, not with -fssa (on)\n"
+"\t\tprivate-calls\tUse a private calling convention with more\n"
+"\t\t\t\targument registers between VSL functions (off)\n"
+"\t\tpromote-globals\tKeep globals in registers in loops and\n"
+"\t\t\t\tfunctions without calls, not with -fssa (on)\n"
+"\t\tpeephole\tForward stored values to later loads and drop\n"
+"\t\t\t\tstores overwritten before being read (on)\n"
+"\t\tsimplify-cfg\tThread jumps, remove unreachable code and favor\n"
+"\t\t\t\tfalling through at branches (on)\n"
+"\t\tssa\t\tGenerate code from the SSA form of the functions, which\n"
+"\t\t\t\tdoes not rotate loops or move cold branches (off)\n"
+"\t\tgvn\t\tReuse values computed earlier in the SSA form,\n"
+"\t\t\t\twith -fssa (on)\n"
+"\t\tvrp\t\tUse the ranges of values in the SSA form for cheaper\n"
+"\t\t\t\tdivisions and to remove branches, with -fssa (on)\n"
+"\t\tconstant-propagation\tReplace variables known to hold a constant\n"
+"\t\t\t\tby it and remove the branches this decides (on)\n"
+"\t\tipa-cp\t\tCopy functions for the constant arguments they are\n"
+"\t\t\t\tcalled with, and simplify the copies (on)\n"
+"\t\tevaluate-calls\tEvaluate calls with constant arguments at compile\n"
+"\t\t\t\ttime if the callee has no other effects (on)\n"
+"\t\tmemoize\tKeep the results of pure recursive functions with one\n"
+"\t\t\t\tor two parameters in a table (off)\n"
+"\t\tmemoize-stats\tCount hits and misses in the tables of memoize\n"
+"\t\t\t\tand write them to stderr at exit (off)\n"
+"\t\tunroll-loops\tRepeat the bodies of small loops, testing the\n"
+"\t\t\t\tcondition only once for counted loops, not with -fssa (on)\n"
+"\t\tstrength-reduction\tStep products of induction variables\n"
+"\t\t\t\tof loops along with them instead of multiplying (on)\n"
+"\t\tclosed-form-loops\tReplace loops that only add up polynomials\n"
+"\t\t\t\tof their counter by the sums (on)\n"
+"\t-f<opt>=<n>\tSet a parameter of an optimization. Available:\n"
+"\t\talign-loops\tAlignment of loop heads in bytes (16)\n"
+"\t\tif-conversion-limit\tCost of the work an if-conversion may\n"
+"\t\t\t\tdo for the branch not taken (4)\n"
+"\t\tipa-cp-budget\tNumber of syntax tree nodes the copies made by\n"
+"\t\t\t\tipa-cp may add (500)\n"
+"\t\teval-steps\tNumber of nodes evaluating a call at compile time\n"
+"\t\t\t\tmay visit (100000)\n"
+"\t\teval-depth\tHow deep calls evaluated at compile time may\n"
+"\t\t\t\tnest (100)\n"
+"\t\tunroll-factor\tNumber of copies of the body of an unrolled loop (4)\n"
+"\t\tunroll-limit\tNumber of syntax tree nodes the body of a loop\n"
+"\t\t\t\tmay have to be unrolled (24)\n";
+
+
+static void
+set_optimization_flag ( char *name )
+{
+    char *value = strchr ( name, '=' );
+    if ( value != NULL )
+    {
+        size_t name_length = value - name;
+        size_t n_parameters =
+            sizeof(optimization_parameters) / sizeof(optimization_parameters[0]);
+        for ( size_t p=0; p<n_parameters; p++ )
+        {
+            if ( strlen ( optimization_parameters[p].name ) == name_length &&
+                 !strncmp ( name, optimization_parameters[p].name, name_length ) )
+            {
+                *optimization_parameters[p].value = atoi ( value+1 );
+                return;
+            }
+        }
+
+        fprintf ( stderr, "Unknown optimization parameter '%s'\n", name );
+        exit ( EXIT_FAILURE );
+    }
+
+    bool enable = true;
+    if ( !strncmp ( name, "no-", 3 ) )
+    {
+        enable = false;
+        name += 3;
+    }
+
+    size_t n_flags = sizeof(optimization_flags) / sizeof(optimization_flags[0]);
+    for ( size_t f=0; f<n_flags; f++ )
+    {
+        if ( !strcmp ( name, optimization_flags[f].name ) )
+        {
+            *optimization_flags[f].enabled = enable;
+            return;
+        }
+    }
+
+    fprintf ( stderr, "Unknown optimization flag '%s'\n", name );
+    exit ( EXIT_FAILURE );
+}
 
 
 static void
 options ( int argc, char **argv )
 {
     int o;
-    while ( (o=getopt(argc,argv,"htTsqu")) != -1 )
+    while ( (o=getopt(argc,argv,"htTsriquf:")) != -1 )
     {
         switch ( o )
         {
@@ -74,8 +239,11 @@ options ( int argc, char **argv )
             case 't':   print_full_tree = true;             break;
             case 'T':   print_simplified_tree = true;       break;
             case 's':   print_symbol_table_contents = true; break;
+            case 'r':   print_rewrite_counts = true;        break;
+            case 'i':   print_ssa = true;                   break;
             case 'q':   print_generated_program = false;    break;
             case 'u':   new_print_style = false;            break;
+            case 'f':   set_optimization_flag ( optarg );   break;
         }
     }
 }